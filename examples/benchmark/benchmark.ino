@@ -0,0 +1,192 @@
+/**
+ * @file benchmark.ino
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ * 
+ * @brief Example: measure the cost of coroutine context switches
+ */
+
+#include "Coroutine.h"
+#include "Event.h"
+#include "SharedStackCoroutine.h"
+
+#include <setjmp.h>
+
+#define ITERATIONS 10000
+#define SIGNAL_INTERVAL 100
+#define NUM_SHARED 8
+#define SHARED_FRAME_BYTES 64
+// Room for the frame plus the saved context and the library's own frames
+#define SHARED_SAVE_BYTES 256
+// Short enough to time within one SysTick period on Cortex M0+
+#define SWITCH_BATCH 100
+#define SWITCH_BATCHES 10
+
+HC::Coroutine ping_task([]
+{
+  while(1)
+    yield();
+});
+
+// Two coroutines waiting for the same thing: one polls, one parks
+volatile bool ready = false;
+HC::Event ready_event;
+int polling_resumes = 0;
+int parked_resumes = 0;
+
+HC::Coroutine polling_task([]
+{
+  while(1)
+  {
+    wait( []{ polling_resumes++; return ready; } );
+    ready = false;
+  }
+});
+
+HC::Coroutine parked_task([]
+{
+  while(1)
+  {
+    parked_resumes++;
+    ready_event.wait();
+  }
+});
+
+
+// Coroutines taking turns on one stack, each with a little live stack
+HC::StaticSharedStack<2048> shared_stack;
+HC::SharedStackCoroutine *shared_tasks[NUM_SHARED];
+
+
+// A bare context switch, against setjmp/longjmp as the library used
+// to switch. Each child takes turns with loop() on this stack.
+byte switch_stack[512] __attribute__((aligned(8)));
+HC::Arm::Context parent_context;
+HC::Arm::Context child_context;
+jmp_buf parent_buf;
+jmp_buf child_buf;
+
+void switch_child( void * )
+{
+  while(1)
+    HC::Arm::switch_context( &child_context, &parent_context );
+}
+
+void setjmp_child( void * )
+{
+  // Started by a switch, then only ever resumed by longjmp
+  if( !setjmp( child_buf ) )
+    HC::Arm::switch_context( &child_context, &parent_context );
+  while(1)
+    if( !setjmp( child_buf ) )
+      longjmp( parent_buf, 1 );
+}
+
+void switch_batch()
+{
+  for( int i=0; i<SWITCH_BATCH; i++ )
+    HC::Arm::switch_context( &parent_context, &child_context );
+}
+
+void setjmp_batch()
+{
+  for( volatile int i=0; i<SWITCH_BATCH; i++ )
+    if( !setjmp( parent_buf ) )
+      longjmp( child_buf, 1 );
+}
+
+uint32_t cycles_per_round_trip( void (*batch)() )
+{
+  // Take the best batch, to leave out any that an interrupt landed in
+  uint32_t best = UINT32_MAX;
+  for( int i=0; i<SWITCH_BATCHES; i++ )
+  {
+    const uint32_t start = HC::Arm::get_cycle_count();
+    batch();
+    const uint32_t cycles = HC::Arm::get_cycles_between( start, HC::Arm::get_cycle_count() );
+    if( cycles < best )
+      best = cycles;
+  }
+  return best / SWITCH_BATCH;
+}
+
+
+void setup() 
+{
+  Serial.begin(115200);
+  while(!Serial);
+  HC::Arm::enable_cycle_count();
+  
+  for( int i=0; i<NUM_SHARED; i++ )
+  {
+    shared_tasks[i] = new HC::SharedStackCoroutine( []
+    {
+      volatile byte frame[SHARED_FRAME_BYTES];
+      frame[0] = 0;
+      while(1)
+        yield();
+    }, shared_stack, SHARED_SAVE_BYTES );
+  }
+}
+
+
+void loop()
+{
+  HC::Arm::prepare_entry_context( child_context, switch_stack + sizeof(switch_stack), switch_child, nullptr );
+  Serial.print("Cycles per switch_context() round trip: ");
+  Serial.print(cycles_per_round_trip(switch_batch));
+  HC::Arm::prepare_entry_context( child_context, switch_stack + sizeof(switch_stack), setjmp_child, nullptr );
+  HC::Arm::switch_context( &parent_context, &child_context );
+  Serial.print(", with setjmp/longjmp: ");
+  Serial.println(cycles_per_round_trip(setjmp_batch));
+  
+  // Each iteration is one switch into the coroutine and one back out
+  unsigned long t0 = micros();
+  for( int i=0; i<ITERATIONS; i++ )
+    ping_task();
+  unsigned long t1 = micros();
+  
+  unsigned long cycles = (t1 - t0) * (VARIANT_MCK / 1000000) / ITERATIONS;
+  Serial.print("Cycles per invoke/yield round trip: ");
+  Serial.println(cycles);
+  
+  // Something happens every SIGNAL_INTERVAL iterations; count how often
+  // each waiter gets resumed
+  polling_resumes = 0;
+  parked_resumes = 0;
+  for( int i=0; i<ITERATIONS; i++ )
+  {
+    if( i % SIGNAL_INTERVAL == 0 )
+    {
+      ready = true;
+      ready_event.signal();
+    }
+    polling_task();
+    parked_task();
+  }
+  Serial.print("Resumes while polling: ");
+  Serial.print(polling_resumes);
+  Serial.print(", while parked: ");
+  Serial.println(parked_resumes);
+  
+  // Invoke the shared-stack coroutines in turn, so that every 
+  // invocation has to swap the stack contents
+  t0 = micros();
+  for( int i=0; i<ITERATIONS; i++ )
+    (*shared_tasks[i % NUM_SHARED])();
+  t1 = micros();
+  
+  cycles = (t1 - t0) * (VARIANT_MCK / 1000000) / ITERATIONS;
+  int shared_bytes = sizeof(shared_stack);
+  for( int i=0; i<NUM_SHARED; i++ )
+    shared_bytes += shared_tasks[i]->get_save_buffer_size();
+  Serial.print("Cycles per round trip with stack swap: ");
+  Serial.println(cycles);
+  Serial.print("Bytes for shared-stack coroutines: ");
+  Serial.print(shared_bytes);
+  Serial.print(", with a stack each: ");
+  Serial.println(NUM_SHARED * (int)sizeof(shared_stack));
+  
+  delay(1000);
+}
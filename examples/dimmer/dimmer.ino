@@ -10,14 +10,24 @@
 #define LEVELS_TO_SSD1306
 #define LEVELS_TO_DOTSTAR
 //#define STACK_USAGE_TO_SERIAL
+//#define IDLE_STATS_TO_SERIAL
 //#define SSD1306_EXAMPLE_AS_SUBSKETCH
+//#define ADAPTIVE_DMX_RECEIVE
 
 #if defined(SSD1306_EXAMPLE_AS_SUBSKETCH) && defined(LEVELS_TO_SSD1306)
 #error Must choose one usage for SSD1306 display driver
 #endif
 
+#ifdef SSD1306_EXAMPLE_AS_SUBSKETCH
+// Send the sub-sketch's delay() calls to HC::delay(); see below
+#define HC_DELAY_REDIRECT
+#endif
+
 #include "Coroutine.h"
+#include "StaticCoroutine.h"
 #include "Hopper.h"
+#include "Scheduler.h"
+#include "IdleManager.h"
 #include "wiring_private.h"
 #include "HC_Uart.h"
 
@@ -25,8 +35,10 @@
 #ifdef SSD1306_EXAMPLE_AS_SUBSKETCH
 // With no functional changes, I was able to get the example program from the SSD1306 
 // display libaray to run in a coroutine very easily. The example program, ssd1306_128x32_i2c.ino
-// contains long delays of a second or two via the `delay()` function. However, `delay()` yields
-// so we can still get serived promptly when in foreground. Therefore, dimming remains smooth.
+// contains long delays of a second or two via the `delay()` function. With HC_DELAY_REDIRECT 
+// (defined above, before Coroutine.h) these become `HC::delay()`, which parks the sub-sketch on
+// the timer wheel, so it isn't resumed at all until the time is up. So we still get serviced 
+// promptly when in foreground, dimming remains smooth, and the idle manager can sleep.
 #include "SubSketch.h"
 // We have to include everythign that the sub-sketch includes
 #include <SPI.h>
@@ -76,7 +88,8 @@ void display_bad_frame();
 #define DMX_RX_PIN 3
 #define DMX_BAUDRATE 250000
 
-volatile bool enable_fg = true;
+HC::Scheduler scheduler;
+HC::IdleManager idle_manager(scheduler);
 
 // Similar to what we get at the bottom of variant.cpp (for your platform), 
 // Except that:
@@ -94,10 +107,10 @@ uint8_t dmx_frame[512];
 HC::Uart::Error serial_error;
 
 
-HC::Coroutine dmx_task([]
+auto dmx_main = []
 {
-  HC::Hopper fg( []{ enable_fg=true; },
-                 []{ enable_fg=false; } );                             
+  HC::Hopper fg( []{ scheduler.attach(*me()); },
+                 []{ scheduler.detach(*me()); } );                             
                  
   pinMode(RED_LED_PIN, OUTPUT);
 #ifdef LEVELS_TO_DOTSTAR
@@ -133,10 +146,23 @@ HC::Coroutine dmx_task([]
     }
 #if defined(STACK_USAGE_TO_SERIAL) && !defined(LEVELS_TO_SSD1306)
     HC_TRACE("CLS %d Stack %d", me()->get_cls_usage(), me()->estimate_stack_peak_usage());
+#endif
+#if defined(HC_HOP_STATS) && !defined(LEVELS_TO_SSD1306)
+    HC_TRACE("Hop latency max %u, residency max %u cycles", 
+             me()->get_hop_stats().latency.get_max(), me()->get_hop_stats().residency.get_max());
+#endif
+#if defined(IDLE_STATS_TO_SERIAL) && !defined(LEVELS_TO_SSD1306)
+    // With the sub-sketch sleeping through its delays, most of this is tickless
+    HC_TRACE("Idle %u ms in %u sleeps, %u tickless skipping %u ticks", 
+             idle_manager.get_stats().idle_ms, idle_manager.get_stats().sleep_count,
+             idle_manager.get_stats().tickless_count, idle_manager.get_stats().ticks_skipped);
 #endif
     yield();
   }
-});
+};
+
+// Stack and lambda live inside the coroutine object, so no heap is needed
+HC::StaticCoroutine<1024, decltype(dmx_main)> dmx_task( dmx_main );
 
 
 void get_dmx_frame()
@@ -178,12 +204,7 @@ void get_frame_data()
   if( start_code != 0 )
     return;
   
-  for( int i=0; i<(int)sizeof(dmx_frame); i++ )
-  {
-    dmx_frame[i] = Serial1.read(&serial_error);
-    if( serial_error )
-      return;
-  }
+  Serial1.read(dmx_frame, sizeof(dmx_frame), &serial_error);
 }
 
 
@@ -256,16 +277,22 @@ unsigned long micros_from_ISR( void )
 // up just before you need it.
 void setup() 
 {  
+  // DMX takes priority whenever it's in foreground
+  scheduler.add(dmx_task, 1);
+#ifdef ADAPTIVE_DMX_RECEIVE
+  // Poll from foreground during frames, which needs the loop to come
+  // round every 88us, so nothing else should hold it for long
+  Serial1.set_adaptive(&scheduler, SERCOM0_IRQn);
+#endif
+#ifdef SSD1306_EXAMPLE_AS_SUBSKETCH
+  scheduler.add(display_subsketch_task, 0);
+#endif
 }  
 
 void loop()
 {
-  if( enable_fg )
-  {
-    dmx_task();
-  }
+  // Sleep while everything is waiting for an interrupt or a timer
+  if( !scheduler.run_one() )
+    idle_manager.idle();
   system_idle_tasks();
-#ifdef SSD1306_EXAMPLE_AS_SUBSKETCH
-  display_subsketch_task();
-#endif
 }
@@ -11,6 +11,7 @@
 
 #include "Coroutine.h"
 #include "Hopper.h"
+#include "Scheduler.h"
 #ifdef USE_DOTSTAR
 #include <Adafruit_DotStar.h>
 
@@ -28,7 +29,7 @@ Adafruit_DotStar strip(DOTSTAR_NUMPIXELS, DOTSTAR_DATAPIN, DOTSTAR_CLOCKPIN, DOT
 
 void startTimer(int frequencyHz);
 void setTimerFrequency(int frequencyHz);
-volatile bool enable_fg = true;
+HC::Scheduler scheduler;
 
 #include "sam.h"
 extern volatile DeviceVectors exception_table;
@@ -38,8 +39,8 @@ HC_INTERRUPT_HANDLER(TC3_Handler)
 
 HC::Coroutine led_flasher_task([]()
 {
-  HC::Hopper fg( []{ enable_fg=true; },
-                 []{ enable_fg=false; } );                             
+  HC::Hopper fg( []{ scheduler.attach(*me()); },
+                 []{ scheduler.detach(*me()); } );                             
 
 #ifdef USE_DOTSTAR
   strip.begin(); // Initialize pins for output
@@ -95,6 +96,7 @@ HC::Coroutine led_flasher_task([]()
 
 void setup() {
   pinMode(RED_LED_PIN, OUTPUT);
+  scheduler.add(led_flasher_task);
   startTimer(10);
 }
 
@@ -144,10 +146,7 @@ void startTimer(int frequencyHz) {
 
 void loop()
 {
-  if( enable_fg )
-  {
-    led_flasher_task();
-  }
+  scheduler.run_one();
   int n = random(3000, 100000);
   for(volatile int i=0; i<n; i++ )
   {
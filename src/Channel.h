@@ -0,0 +1,166 @@
+/**
+ * @file Channel.h
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ *
+ * @brief Bounded channel between coroutines, safe across interrupts
+ */
+#ifndef Channel_h
+#define Channel_h
+
+#if __cplusplus <= 199711L
+  #error This library needs at least a C++11 compliant compiler
+#endif
+
+#include "HC_Config.h"
+
+#include "Coroutine.h"
+
+#include <atomic>
+#include <cstdint>
+
+namespace HC
+{
+
+/**
+ * @brief Fixed-capacity single-producer, single-consumer channel.
+ *
+ * One side sends and the other receives; each side may be a coroutine
+ * running in foreground, a coroutine that has hopped onto an interrupt,
+ * or plain interrupt or foreground code using the non-blocking calls.
+ *
+ * There are no locks. The producer only ever writes `head` and the
+ * consumer only ever writes `tail`, and each is a single aligned word,
+ * so plain loads and stores are enough. This works on Cortex M0, which
+ * has no LDREX/STREX, and never masks interrupts.
+ *
+ * The blocking calls `yield()` while the channel is full or empty, so
+ * a coroutine waiting on it costs nothing between invocations. In an
+ * interrupt-hopped coroutine this means returning from the ISR. Outside
+ * of any coroutine, `yield()` does nothing, so the blocking calls spin.
+ *
+ * @tparam T type of the items, which are copied in and out.
+ * @tparam N capacity, which must be a power of 2.
+ */
+template<typename T, int N>
+class Channel
+{
+public:
+  /**
+   * Create an empty channel.
+   */
+  Channel() :
+    head( 0 ),
+    tail( 0 )
+  {
+  }
+
+  /**
+   * Send an item if there is room. Never blocks.
+   *
+   * @param item the item to send.
+   * @return true if the item was sent.
+   */
+  bool try_send( const T &item )
+  {
+    const uint32_t h = head.load( std::memory_order_relaxed );
+    if( h - tail.load( std::memory_order_acquire ) >= N )
+      return false;
+    buffer[h & (N-1)] = item;
+    head.store( h + 1, std::memory_order_release );
+    return true;
+  }
+
+  /**
+   * Receive an item if there is one. Never blocks.
+   *
+   * @param item updated with the received item.
+   * @return true if an item was received.
+   */
+  bool try_receive( T &item )
+  {
+    const uint32_t t = tail.load( std::memory_order_relaxed );
+    if( head.load( std::memory_order_acquire ) == t )
+      return false;
+    item = buffer[t & (N-1)];
+    tail.store( t + 1, std::memory_order_release );
+    return true;
+  }
+
+  /**
+   * Send an item, yielding while the channel is full.
+   *
+   * @param item the item to send.
+   */
+  void send( const T &item )
+  {
+    while( !try_send( item ) )
+      Coroutine::yield();
+  }
+
+  /**
+   * Receive an item, yielding while the channel is empty.
+   *
+   * @param item updated with the received item.
+   */
+  void receive( T &item )
+  {
+    while( !try_receive( item ) )
+      Coroutine::yield();
+  }
+
+  /**
+   * Receive an item, yielding while the channel is empty.
+   *
+   * @return the received item.
+   */
+  T receive()
+  {
+    T item;
+    receive( item );
+    return item;
+  }
+
+  /**
+   * Discard everything in the channel. Never blocks. This counts as 
+   * receiving, so only the consumer may do it.
+   */
+  void clear()
+  {
+    tail.store( head.load( std::memory_order_acquire ), std::memory_order_release );
+  }
+
+  /**
+   * Get the number of items in the channel. Only a snapshot if the
+   * other side is running concurrently.
+   */
+  int count() const
+  {
+    return head.load( std::memory_order_acquire ) - tail.load( std::memory_order_acquire );
+  }
+
+  bool is_empty() const
+  {
+    return count() == 0;
+  }
+
+  bool is_full() const
+  {
+    return count() >= N;
+  }
+
+private:
+  static_assert( N > 0 && (N & (N-1)) == 0, "channel capacity must be a power of 2" );
+  static_assert( sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "channel indices must be single words" );
+
+  T buffer[N];
+
+  // Free-running counters; they wrap together, so differences are correct
+  std::atomic<uint32_t> head; // only written by the producer
+  std::atomic<uint32_t> tail; // only written by the consumer
+};
+
+} // namespace
+
+#endif
@@ -13,7 +13,6 @@
 
 #include <cstring>
 #include <functional>
-#include <csetjmp> 
 #include <cstdint>
 #include "Arduino.h"
 
@@ -21,46 +20,63 @@ using namespace std;
 using namespace HC;
 using namespace Arm;
 
-// Only enable when constructing after system initialisation, eg in setup()
 #define CONSTRUCTOR_TRACE HC_DISABLED_TRACE
 
-Coroutine::Coroutine( function<void()> child_function_ ) :
-  child_function( child_function_ ),
-  stack_size( default_stack_size ),
-  child_stack_memory( (byte *)calloc(default_stack_size, 1) ),
-  child_status( READY )
-{    
+// Tells the linker which way we were built; see HC_Config.h
+#ifdef HC_NATIVE_TLS
+const int HC::Config::native_tls_on = 1;
+#else
+const int HC::Config::native_tls_off = 1;
+#endif
+
+Coroutine::Coroutine( ChildFunction child_function_ ) :
+  Coroutine( HEAP_STACK, (byte *)malloc(default_stack_size), default_stack_size, nullptr, move(child_function_) )
+{
   HC_ASSERT(child_function, "NULL child function was supplied");
-  jmp_buf initial_jmp_buf;
-  int val;
-  CONSTRUCTOR_TRACE("this=%p sp=%p", this, get_sp());
-  CONSTRUCTOR_TRACE("last arg begins %p ends %p", &child_function_, &child_function_ + 1);
-  CONSTRUCTOR_TRACE("first local begins %p ends %p", &initial_jmp_buf, &initial_jmp_buf + 1);
-  switch( val = setjmp(initial_jmp_buf) ) { 
-    case IMMEDIATE: {
-      // Get current stack pointer and frame address 
-      // taking care that it will have a different stack frame
-      byte *frame_end = (byte *)(&child_function_ + 1);
-      byte *stack_pointer = (byte *)( get_jmp_buf_sp(initial_jmp_buf) );  
-      
-      CONSTRUCTOR_TRACE("this=%p sp=%p, stack_pointer=%p, frame_end=%p", this, get_sp(), stack_pointer, frame_end);
+}
 
-      // Get the child's stack ready                   
-      byte *child_stack_pointer = prepare_child_stack( frame_end, stack_pointer );
-      
-      // Create the child's jump buf
-      prepare_child_jmp_buf( child_jmp_buf, initial_jmp_buf, stack_pointer, child_stack_pointer );
-      break;
-    }
-    case PARENT_TO_CHILD_STARTING: {
-      CONSTRUCTOR_TRACE("this=%p me=%p sp=%p", this, me(), get_sp());
-      child_main_function();            
-    }
-    default: {
-      // This setjmp call was only to get the stack pointer. 
-      HC_ERROR("unexpected longjmp value: %d", val);
-    }
-  }
+
+Coroutine::Coroutine( ChildFunction child_function_, StackPool &pool ) :
+  Coroutine( POOL_STACK, pool.allocate(), pool.get_block_size(), &pool, move(child_function_) )
+{
+  HC_ASSERT(child_function, "NULL child function was supplied");
+}
+
+
+Coroutine::Coroutine( ChildFunction child_function_, byte *stack_memory, int stack_size_ ) :
+  Coroutine( CALLER_STACK, stack_memory, stack_size_, nullptr, move(child_function_) )
+{
+  HC_ASSERT(child_function, "NULL child function was supplied");
+}
+
+
+Coroutine::Coroutine( byte *stack_memory, int stack_size_ ) :
+  Coroutine( CALLER_STACK, stack_memory, stack_size_, nullptr, ChildFunction() )
+{
+}
+
+
+Coroutine::Coroutine( StackSource stack_source_, byte *stack_memory, int stack_size_, StackPool *stack_pool_, ChildFunction child_function_ ) :
+  child_function( move(child_function_) ),
+  stack_source( stack_source_ ),
+  stack_pool( stack_pool_ ),
+  stack_size( stack_size_ ),
+  child_stack_memory( stack_memory ),
+  child_status( READY ),
+  child_active( false ),
+  parked( false ),
+  next_waiter( nullptr ),
+  current_hopper( nullptr ),
+  cls_top( 0 ),
+  stack_guard_p( nullptr ),
+  stack_watermark( stack_size_ )
+{    
+  HC_ASSERT(child_stack_memory, "no memory for child stack");
+  HC_ASSERT(((uintptr_t)child_stack_memory & 7) == 0, "child stack %p is not 8-byte aligned", child_stack_memory);
+  
+  paint_child_stack();
+  prepare_entry_context();
+  CONSTRUCTOR_TRACE("this=%p stack=%p size=%d", this, child_stack_memory, stack_size);
 }
 
 
@@ -68,7 +84,7 @@ Coroutine::~Coroutine()
 {
   check_valid_this();
   HC_ASSERT( child_status == COMPLETE, "destruct when child was not complete, status %d", (int)child_status );
-  delete[] child_stack_memory;
+  release_child_stack();
   bring_in_Integration();
 }
 
@@ -83,13 +99,97 @@ void Coroutine::wait( const std::function<bool()> &test )
 }
 
 
-void Coroutine::set_hop_lambda( std::function<void()> hop )
+void Coroutine::run_hop_lambda( const HopLambda &hop )
+{
+  // Hop lambdas expect to be able to use me(), and our TLS
+  RAII_TR tr(this);
+#ifdef HC_NATIVE_TLS
+  byte * const previous_tls_pointer = current_tls_pointer;
+  current_tls_pointer = tls_pointer;
+  hop();
+  current_tls_pointer = previous_tls_pointer;
+#else
+  hop();
+#endif
+}
+
+
+void Coroutine::release_child_stack()
 {
-  Task::set_hop_lambda( [=]
+  if( !child_stack_memory )
+    return;
+    
+  switch( stack_source ) {
+    case HEAP_STACK: {
+      free( child_stack_memory );
+      break;
+    }
+    case POOL_STACK: {
+      stack_pool->release( child_stack_memory );
+      break;
+    }
+    case CALLER_STACK: {
+      // Caller still owns it
+      break;
+    }
+  }
+  child_stack_memory = nullptr;
+}
+
+
+bool Coroutine::is_blocked() const
+{
+  return parked || is_complete();
+}
+
+
+void Coroutine::restart()
+{
+  check_valid_this();
+  HC_ASSERT( child_status != RUNNING, "restart when child was running" );
+  HC_ASSERT( !child_active, "restart when child was active" );
+  HC_ASSERT( !parked, "restart when child was waiting" );
+  
+  if( !child_stack_memory )
   {
-    RAII_TR tr(this);
-    hop();
-  } );
+    // Pool stacks go back to the pool on completion
+    child_stack_memory = stack_pool->allocate();
+    HC_ASSERT(child_stack_memory, "no memory for child stack");
+  }
+  
+  // Make sure no one else is using the stack, and start it afresh
+  make_child_stack_resident();
+  paint_child_stack();
+  prepare_entry_context();
+  current_hopper = nullptr;
+  child_status = READY;
+  
+  // Let our scheduler know, if we have one
+  wake();
+}
+
+
+void Coroutine::restart( ChildFunction child_function_ )
+{
+  child_function = move(child_function_);
+  HC_ASSERT(child_function, "NULL child function was supplied");
+  restart();
+}
+
+
+void Coroutine::abandon()
+{
+  check_valid_this();
+  if( child_status == COMPLETE )
+    return;
+  HC_ASSERT( !child_active, "abandon when child was active" );
+  HC_ASSERT( !parked, "abandon when child was waiting" );
+  HC_ASSERT( !current_hopper, "abandon when child was in a Hopper" );
+  
+  // As if the child had returned, except that its frames are just left
+  child_status = COMPLETE;
+  if( stack_source == POOL_STACK )
+    release_child_stack();
 }
 
 
@@ -101,10 +201,27 @@ pair<const byte *, const byte *> Coroutine::get_child_stack_bounds()
 
 int Coroutine::estimate_stack_peak_usage()
 {
-    byte *p = child_stack_memory + cls_heap_top;
-    while( *p==0 && p < child_stack_memory+stack_size )
-      p++;
-    return child_stack_memory+stack_size-p;      
+    if( !child_stack_memory )
+      return 0;
+      
+    // Stack usage only ever goes up, so we only need to look below the
+    // last watermark we found. Everything between the guard and the 
+    // deepest the stack has been is still paint, so binary search for 
+    // the lowest word that isn't. An untouched run of words in a frame
+    // could make this an under-estimate, as could a word that happened 
+    // to be written with the paint value.
+    const uint32_t *low = stack_guard_p + stack_guard_words;
+    const uint32_t *high = (const uint32_t *)( child_stack_memory + stack_watermark );
+    while( low < high )
+    {
+      const uint32_t * const mid = low + (high - low) / 2;
+      if( *mid == stack_paint )
+        low = mid + 1;
+      else
+        high = mid;
+    }
+    stack_watermark = (const byte *)low - child_stack_memory;
+    return stack_size - stack_watermark;      
 }
 
 
@@ -114,32 +231,18 @@ int Coroutine::get_cls_usage()
 }
 
 
-byte *Coroutine::prepare_child_stack( byte *frame_end, byte *stack_pointer )
+void Coroutine::prepare_entry_context()
 {
-  // Decide how much stack to keep (basically the current frame, i.e. the 
-  // stack frame of this invocation of this function) and copy it into the 
-  // new stack, at the bottom.
-  // Note: stacks usually begin at the highest address and work down
-  int bytes_to_retain = frame_end - stack_pointer;
-  byte *child_stack_pointer = child_stack_memory + stack_size - bytes_to_retain;      
-  CONSTRUCTOR_TRACE("moving %d from %p to %p", bytes_to_retain, stack_pointer, child_stack_pointer );
-  memmove( child_stack_pointer, stack_pointer, bytes_to_retain );
-  return child_stack_pointer;
+  // Start in child_entry() at the top of the stack, with the TR set
+  byte * const stack_top = (byte *)( (uintptr_t)(child_stack_memory + stack_size) & ~7 );
+  Arm::prepare_entry_context( child_context, stack_top, child_entry, this );
+  set_context_tr( child_context, this );
 }
 
 
-void Coroutine::prepare_child_jmp_buf( jmp_buf &child_jmp_buf, const jmp_buf &initial_jmp_buf, byte *parent_stack_pointer, byte *child_stack_pointer )
+[[ noreturn ]] void Coroutine::child_entry( void *this_ )
 {
-  // Prepare a jump buffer for the child and point it to the new stack
-  CONSTRUCTOR_TRACE("initial jmp_buf has tr=%08x sl=%08x fp=%08x sp=%08x lr=%08x", 
-      initial_jmp_buf[5], initial_jmp_buf[6], initial_jmp_buf[7], 
-      initial_jmp_buf[8], initial_jmp_buf[9] );
-  byte *parent_frame_pointer = (byte *)(get_jmp_buf_fp(initial_jmp_buf));
-  byte *child_frame_pointer = parent_frame_pointer + (child_stack_pointer-parent_stack_pointer);;
-  copy_jmp_buf( child_jmp_buf, initial_jmp_buf );
-  set_jmp_buf_sp( child_jmp_buf, child_stack_pointer);
-  set_jmp_buf_fp( child_jmp_buf, child_frame_pointer);
-  set_jmp_buf_tr( child_jmp_buf, this);
+  ((Coroutine *)this_)->child_main_function();
 }
 
 
@@ -147,10 +250,11 @@ void Coroutine::prepare_child_jmp_buf( jmp_buf &child_jmp_buf, const jmp_buf &in
 {
   check_valid_this();
   child_status = RUNNING;
+  record_resume();
     
   // Invoke the child. We take the view that this is enough to give
   // it its first "timeslice"
-  child_function();
+  call_child_function();
     
   // If we get here, child returned without yielding (i.e. like a normal function).
   child_status = COMPLETE;
@@ -160,41 +264,135 @@ void Coroutine::prepare_child_jmp_buf( jmp_buf &child_jmp_buf, const jmp_buf &in
 }
 
 
+void Coroutine::paint_child_stack()
+{
+  // CLS comes first, then the guard, and everything above that gets 
+  // painted so we can see how much stack has been used.
+  initialise_cls();
+  place_stack_guard();
+  
+  uint32_t *p = stack_guard_p + stack_guard_words;
+  uint32_t * const end = (uint32_t *)( child_stack_memory + stack_size );
+  while( p < end )
+    *p++ = stack_paint;
+  stack_watermark = stack_size;
+}
+
+
+void Coroutine::initialise_cls()
+{
+#ifdef HC_NATIVE_TLS
+  // The TLS block is the same size for everyone, so set it all up now.
+  // On Arm, the thread pointer is 8 bytes below the block.
+  initialise_tls_block( child_stack_memory );
+  cls_top = cls_heap_top;
+  tls_pointer = child_stack_memory - 8;
+#else
+  // Set up the items we know about so far. More may turn up later; see
+  // get_cls_address().
+  cls_top = 0;
+  initialise_cls_items( child_stack_memory, cls_top );
+#endif
+}
+
+
+void Coroutine::place_stack_guard()
+{
+  stack_guard_p = (uint32_t *)( child_stack_memory + ((cls_top + 3) & ~3) );
+  for( int i=0; i<stack_guard_words; i++ )
+    stack_guard_p[i] = stack_guard;
+}
+
+
+inline void Coroutine::check_stack_guard() const
+{
+#ifndef HC_DISABLE_STACK_GUARD
+  // If the stack overflowed, we'd expect it to have written over the
+  // guard on its way down to the CLS.
+  static_assert( stack_guard_words == 2, "check_stack_guard() needs updating" );
+  if( stack_guard_p[0] != stack_guard || stack_guard_p[1] != stack_guard )
+    HC_ERROR("stack overflow in coroutine %p", this);
+#endif
+}
+
+
+inline void Coroutine::record_resume()
+{
+#ifdef HC_HOP_STATS
+  // Latency counts from entry to the interrupt handler, if there was 
+  // one; residency counts from here to when we next yield.
+  const uint32_t now = get_cycle_count();
+  if( IsrEntryStamp::is_active() )
+    get_hop_stats().latency.record( get_cycles_between( IsrEntryStamp::get_entry_cycles(), now ) );
+  resume_cycles = now;
+  resumed_in_interrupt = is_in_interrupt();
+#endif
+}
+
+
+inline void Coroutine::record_yield()
+{
+#ifdef HC_HOP_STATS
+  if( resumed_in_interrupt )
+    get_hop_stats().residency.record( get_cycles_between( resume_cycles, get_cycle_count() ) );
+#endif
+}
+
+
+void Coroutine::call_child_function()
+{
+  child_function();
+}
+
+
+void Coroutine::make_child_stack_resident()
+{
+  // Our stack is all ours, so it's always in place
+}
+
+
 void Coroutine::invoke()
 {
   check_valid_this();
   
-  // Save the current next parent jump buffer
-  int val;
-  switch( val = setjmp(parent_jmp_buf) ) {                    
-    case IMMEDIATE: {
-      jump_to_child();
-    }
-       
-    case CHILD_TO_PARENT: {
-      break;
-    }
-                    
-    default: {
-      HC_ERROR("unexpected longjmp value: %d", val);
-    }
-  }  
+  // If we're waiting on an Event etc there's no point switching in: 
+  // we'll be un-parked when it's signalled.
+  if( parked )
+    return;
+    
+  jump_to_child();
 }
         
         
 void Coroutine::jump_to_child()
 {
   switch( child_status ) {
-    case READY: {
-      longjmp(child_jmp_buf, PARENT_TO_CHILD_STARTING);
-      // No break required: longjump does not return
-    }
+    case READY: 
     case RUNNING: {
-      longjmp(child_jmp_buf, PARENT_TO_CHILD);
-      // No break required: longjump does not return
+      // Returns when the child yields or completes
+      make_child_stack_resident();
+      child_active = true;
+#ifdef HC_NATIVE_TLS
+      // The context switch changes the TR; change the thread pointer with it
+      byte * const parent_tls_pointer = current_tls_pointer;
+      current_tls_pointer = tls_pointer;
+      switch_context( &parent_context, &child_context );
+      current_tls_pointer = parent_tls_pointer;
+#else
+      switch_context( &parent_context, &child_context );
+#endif
+      check_stack_guard();
+      
+      // Now we're off the child's stack, we can recycle it if done
+      if( child_status == COMPLETE && stack_source == POOL_STACK )
+        release_child_stack();
+      break;
     }
     case COMPLETE: {
-      // All finished, nothing to do except return
+      // All finished. If we completed after a transfer, our stack was 
+      // not released at the time, so do it now.
+      if( stack_source == POOL_STACK )
+        release_child_stack();
     }
   }   
 }
@@ -204,36 +402,108 @@ void Coroutine::yield_nonstatic()
 {
   check_valid_this();
   HC_ASSERT( child_status == RUNNING, "yield when child was not running, status %d", (int)child_status );
+  check_stack_guard();
   
-  int val;
-  switch( val = setjmp( child_jmp_buf ) ) {                    
-    case IMMEDIATE: {
-      jump_to_parent();
-    }
-    case PARENT_TO_CHILD: {
-      // If the child has ever yielded, its context will come back to here
-      break; 
-    }    
-    default: {
-      HC_ERROR("unexpected longjmp value: %d", val);
-    }
-  }    
+  // Returns when the parent next invokes us
+  record_yield();
+  child_active = false;
+  switch_context( &child_context, &parent_context );
+  record_resume();
+}
+
+
+void Coroutine::transfer_to( Coroutine &target )
+{
+  check_valid_this();
+  target.check_valid_this();
+  HC_ASSERT( me() == this, "transfer from %p which is not the current coroutine", this );
+  HC_ASSERT( &target != this, "transfer to self %p", this );
+  HC_ASSERT( target.child_status != COMPLETE, "transfer to %p which is complete", &target );
+  HC_ASSERT( !target.child_active, "transfer to %p which is already active", &target );
+  HC_ASSERT( !target.parked, "transfer to %p which is parked", &target );
+  check_stack_guard();
+  
+  // Hand our invoker over to the target. Switching to the target's 
+  // context also switches the TR over to it.
+  target.make_child_stack_resident();
+  target.parent_context = parent_context;
+  target.child_active = true;
+  child_active = false;
+  
+  // Returns when we are next invoked
+  record_yield();
+#ifdef HC_NATIVE_TLS
+  current_tls_pointer = target.tls_pointer;
+#endif
+  switch_context( &child_context, &target.child_context );
+  record_resume();
 }
 
 
 void Coroutine::jump_to_parent()
 {
-  longjmp( parent_jmp_buf, CHILD_TO_PARENT );
+  check_stack_guard();
+  record_yield();
+  child_active = false;
+  switch_context( &child_context, &parent_context );
+  HC_ERROR("child was resumed after completing");
+}
+
+
+#ifdef HC_NATIVE_TLS
+// From the linker script. The sizes are absolute symbols, so only 
+// their addresses mean anything.
+extern "C" const byte __tdata_source[];
+extern "C" const byte __tdata_size[];
+extern "C" const byte __tbss_size[];
+extern "C" const byte __tls_align[];
+
+void Coroutine::initialise_tls_block( byte *block )
+{
+  // Initial values from the .tdata image, then zeroes for .tbss
+  memcpy( block, __tdata_source, (int)__tdata_size );
+  memset( block + (int)__tdata_size, 0, (int)__tbss_size );
 }
 
 
+void Coroutine::init_foreground_tls()
+{
+  // Every coroutine gets a block this size at the bottom of its stack
+  HC_ASSERT( (int)__tls_align <= 8, "TLS alignment %d is not supported", (int)__tls_align );
+  cls_heap_top = ((int)__tdata_size + (int)__tbss_size + 7) & ~7;
+
+  byte * const block = (byte *)malloc( cls_heap_top );
+  HC_ASSERT( block, "no memory for foreground TLS" );
+  initialise_tls_block( block );
+  current_tls_pointer = block - 8;
+}
+
+
+int Coroutine::cls_heap_top = 0;
+byte *Coroutine::current_tls_pointer = nullptr;
+#else
 extern void *__HeapLimit;
+void Coroutine::initialise_cls_items( byte *cls_heap, int &top )
+{
+  // Zero the part of the CLS heap above top, like calloc() would give 
+  // us, then fill in initial values for any items in that part.
+  memset( cls_heap + top, 0, cls_heap_top - top );
+  for( int i=0; i<num_cls_initialised_items; i++ )
+  {
+    const __emutls_object * const euo = cls_initialised_items[i];
+    if( (int)euo->loc.offset >= top )
+      memcpy( cls_heap + euo->loc.offset, euo->templ, euo->size );
+  }
+  top = cls_heap_top;
+}
+
+
 void *Coroutine::get_cls_address(void *obj)
 {
     // This basically implements __thread by replacing the GCC builtin
     // function __emutls_get_address().
     __emutls_object * const euo = (__emutls_object *)obj;   
-    const Coroutine *me = ::me();
+    Coroutine * const me = ::me();
     if( euo->loc.offset==0 )
     {
       // The first time a CLS item is accessed, regardless of context, we
@@ -242,6 +512,14 @@ void *Coroutine::get_cls_address(void *obj)
         cls_heap_top++; // If we put 0 into euo.loc.offset, it will be indistinguishable from its init value of 0
       euo->loc.offset = (cls_heap_top + euo->align - 1) & ~(euo->align - 1);
       cls_heap_top = euo->loc.offset + euo->size;
+      
+      // Remember items with initial values, for every context that 
+      // hasn't got this far yet
+      if( euo->templ )
+      {
+        HC_ASSERT( num_cls_initialised_items < max_cls_initialised_items, "too many initialised CLS items" );
+        cls_initialised_items[num_cls_initialised_items++] = euo;
+      }
     }
     
     byte *cls_heap;
@@ -249,21 +527,36 @@ void *Coroutine::get_cls_address(void *obj)
     {
       // CLS data accessed in a coroutine  
       cls_heap = me->child_stack_memory;
+      
+      // CLS may have grown since we painted our stack, so set up any
+      // of it that we haven't seen yet.
+      if( me->cls_top < cls_heap_top )
+      {
+        initialise_cls_items( cls_heap, me->cls_top );
+        me->place_stack_guard();
+      }
     }
     else
     {
       // CLS data accessed outside of any coroutine
       // The first time this happens, we'll have to allocate a block of memory
       if( !cls_foreground_heap )
-        cls_foreground_heap = (byte *)calloc(default_stack_size, 1);
+        cls_foreground_heap = (byte *)malloc(default_stack_size);
+      HC_ASSERT( cls_heap_top <= default_stack_size, "foreground CLS overflow" );
       cls_heap = cls_foreground_heap;
+      if( cls_foreground_top < cls_heap_top )
+        initialise_cls_items( cls_heap, cls_foreground_top );
     }
     return cls_heap + euo->loc.offset;
 }
 
 
 int Coroutine::cls_heap_top = 0;
-byte *Coroutine::cls_foreground_heap = 0;
+byte *Coroutine::cls_foreground_heap = nullptr;
+int Coroutine::cls_foreground_top = 0;
+Coroutine::__emutls_object *Coroutine::cls_initialised_items[max_cls_initialised_items];
+int Coroutine::num_cls_initialised_items = 0;
+#endif
 
 
 // This makes sure the TR is a NULL pointer for the foreground
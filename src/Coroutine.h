@@ -13,35 +13,150 @@
   #error This library needs at least a C++11 compliant compiler
 #endif
 
+#include "HC_Config.h"
+
 #include "Coroutine_arm.h"
 #include "Task.h"
+#include "StackPool.h"
+#include "InplaceFunction.h"
 #include "Integration.h"
 
 #include <functional>
-#include <csetjmp> 
 #include <cstdint>
 #include <atomic>
 #include "Arduino.h"
 
+// Define this to remove the stack overflow check from context switches
+//#define HC_DISABLE_STACK_GUARD
+
 namespace HC
 {
 
+class WaitQueue;
+class SharedStackCoroutine;
+class Hopper;
+
 class Coroutine : public Task
 {
 public:
-  explicit Coroutine( std::function<void()> child_function_ ); 
+  /**
+   * Type of child functions. These are held without heap allocation.
+   */
+  typedef InplaceFunction<void()> ChildFunction;
+
+  /**
+   * Create a coroutine with a stack of the default size, allocated 
+   * from the heap.
+   */
+  explicit Coroutine( ChildFunction child_function_ ); 
+  
+  /**
+   * Create a coroutine with a stack taken from a pool. The stack is 
+   * returned to the pool when the coroutine completes.
+   */
+  Coroutine( ChildFunction child_function_, StackPool &pool ); 
+  
+  /**
+   * Create a coroutine with a stack supplied by the caller, who 
+   * continues to own the memory. It must be 8-byte aligned and must 
+   * outlive the coroutine.
+   */
+  Coroutine( ChildFunction child_function_, byte *stack_memory, int stack_size_ ); 
+  
   ~Coroutine();
     
   inline static Coroutine *me();
   inline static void yield();
 
   static void wait( const std::function<bool()> &test );
-  void set_hop_lambda( std::function<void()> hop );
+  
+  /**
+   * Switch directly from this coroutine to another one, without going 
+   * via our invoker. The target takes over our invoker, so its next 
+   * `yield()` (or its completion) returns to whoever invoked us, while
+   * we stay suspended until we are next invoked. Hop requests made by 
+   * the target take effect when the target is next invoked through its
+   * own functor interface.
+   * 
+   * Must be called from within this coroutine. The target must not be 
+   * complete and must not be running or invoking another coroutine.
+   * 
+   * @param target the coroutine to transfer to.
+   */
+  void transfer_to( Coroutine &target );
+  
+  inline bool is_complete() const;
+  
+  /**
+   * Run the child function again from the start, re-using this object. 
+   * The stack is re-used too (a pool stack, having gone back to the 
+   * pool on completion, is re-allocated), and CLS starts afresh. The 
+   * functor's function pointer does not change, so interrupt vectors 
+   * pointing at us stay valid.
+   * 
+   * Must be complete or not yet started, and not called from within
+   * this coroutine.
+   */
+  void restart();
+  
+  /**
+   * Restart, as above, with a new child function.
+   * 
+   * @param child_function_ the new child function.
+   */
+  void restart( ChildFunction child_function_ );
+  
+  /**
+   * We're blocked while parked on a wait queue, and once complete.
+   */
+  bool is_blocked() const;
+  
+  /**
+   * Get the innermost `Hopper` we're in, if any. Code run from a hop 
+   * lambda can keep this to tell later whether we're still in that hop.
+   */
+  inline Hopper *get_current_hopper() const;
+  
   std::pair<const byte *, const byte *> get_child_stack_bounds();
   int estimate_stack_peak_usage();
   int get_cls_usage();
   
+protected:
+  /**
+   * Create a coroutine with no child function, for use by a subclass 
+   * that over-rides `call_child_function()`. The stack is supplied 
+   * by the subclass, under the same rules as for a caller-supplied stack.
+   */
+  Coroutine( byte *stack_memory, int stack_size_ ); 
+  
+  /**
+   * Called on the child's stack to run the body of the coroutine.
+   */
+  virtual void call_child_function();
+  
+  /**
+   * Called just before switching onto the child's stack. Subclasses may
+   * over-ride if the stack contents might not be in place.
+   */
+  virtual void make_child_stack_resident();
+  
+  void run_hop_lambda( const HopLambda &hop );
+  
+  /**
+   * Mark the child as complete without running the rest of it. The 
+   * stack is dropped as it stands, so nothing on it is destructed. 
+   * Does nothing if already complete.
+   * 
+   * Must not be called from within this coroutine, and the child must 
+   * not be waiting or inside a Hopper.
+   */
+  void abandon();
+
 private:
+  friend class WaitQueue;
+  friend class SharedStackCoroutine;
+  friend class Hopper;
+  
   enum ChildStatus
   {
     READY,
@@ -49,14 +164,14 @@ private:
     COMPLETE
   };
   
-  enum LongJmpValue
+  enum StackSource
   {
-    IMMEDIATE = 0, // Must be zero
-    PARENT_TO_CHILD = 1, // All the others must be non-zero
-    CHILD_TO_PARENT = 2,
-    PARENT_TO_CHILD_STARTING = 3
+    HEAP_STACK,
+    POOL_STACK,
+    CALLER_STACK
   };
-
+  
+#ifndef HC_NATIVE_TLS
   // from libgcc/emutls.c
   typedef unsigned int word __attribute__((mode(word)));
   typedef unsigned int pointer __attribute__((mode(pointer)));
@@ -70,6 +185,7 @@ private:
     } loc;
     void *templ;
   };
+#endif
 
   class RAII_TR
   {
@@ -81,26 +197,71 @@ private:
     std::atomic<void *> const previous_tr;
   };
 
-  byte *prepare_child_stack( byte *frame_end, byte *stack_pointer );
-  void prepare_child_jmp_buf( jmp_buf &child_jmp_buf, const jmp_buf &initial_jmp_buf, byte *parent_stack_pointer, byte *child_stack_pointer );
+  Coroutine( StackSource stack_source_, byte *stack_memory, int stack_size_, StackPool *stack_pool_, ChildFunction child_function_ ); 
+  void paint_child_stack();
+  void initialise_cls();
+  void place_stack_guard();
+  inline void check_stack_guard() const;
+  inline void record_resume();
+  inline void record_yield();
+  void prepare_entry_context();
+  [[ noreturn ]] static void child_entry( void *this_ );
   [[ noreturn ]] void child_main_function();
   void invoke();
   void jump_to_child();
   void yield_nonstatic();
   [[ noreturn ]] void jump_to_parent();
+  void release_child_stack();
+#ifdef HC_NATIVE_TLS
+  static void initialise_tls_block( byte *block );
+  
+  // Runs before other static constructors, which may use TLS
+  static void init_foreground_tls() __attribute__((constructor(101)));
+#else
+  static void initialise_cls_items( byte *cls_heap, int &top );
   static void *get_cls_address(void *obj) asm ("__emutls_get_address");
+#endif
   
-  const std::function<void()> child_function; 
+  ChildFunction child_function; 
+  const StackSource stack_source;
+  StackPool * const stack_pool;
   const int stack_size;
-  byte * const child_stack_memory;
+  byte *child_stack_memory;
   ChildStatus child_status;
-  jmp_buf parent_jmp_buf;
-  jmp_buf child_jmp_buf;
+  bool child_active;
+  volatile bool parked;
+  Coroutine *next_waiter;
+  Hopper *current_hopper;
+  int cls_top;
+#ifdef HC_NATIVE_TLS
+  byte *tls_pointer;
+#endif
+  uint32_t *stack_guard_p;
+  int stack_watermark;
+#ifdef HC_HOP_STATS
+  uint32_t resume_cycles;
+  bool resumed_in_interrupt;
+#endif
+  Arm::Context parent_context;
+  Arm::Context child_context;
     
   static int cls_heap_top;
+#ifdef HC_NATIVE_TLS
+  // The thread pointer for whichever context is running, for 
+  // __aeabi_read_tp() in Coroutine_arm.S. Switched along with the TR.
+  static byte *current_tls_pointer asm ("hc_current_tls_pointer");
+#else
   static byte *cls_foreground_heap;
+  static int cls_foreground_top;
+  static __emutls_object *cls_initialised_items[];
+  static int num_cls_initialised_items;
+  static const int max_cls_initialised_items = 16;
+#endif
     
   static const int default_stack_size = 2048;
+  static const uint32_t stack_paint = 0xA5A5A5A5;
+  static const uint32_t stack_guard = 0x5AFE57AC;
+  static const int stack_guard_words = 2;
 };
 
 ///-- 
@@ -120,6 +281,18 @@ void Coroutine::yield()
 }
 
 
+bool Coroutine::is_complete() const
+{
+  return child_status == COMPLETE;
+}
+
+
+Hopper *Coroutine::get_current_hopper() const
+{
+  return current_hopper;
+}
+
+
 Coroutine::RAII_TR::RAII_TR( void *new_tr ) :
   previous_tr( Arm::get_tr() )
 {
@@ -144,10 +317,31 @@ inline void wait( const std::function<bool()> &test )
   HC::Coroutine::wait(test);
 }
 
+namespace HC
+{
+/**
+ * Replacement for Arduino's `delay()`. In a coroutine this sleeps on
+ * the system timer wheel (see TimerWheel.h), so the coroutine is not
+ * resumed until the time is up. Otherwise it just calls `delay()`.
+ *
+ * @param ms the time to wait for.
+ */
+void delay( unsigned long ms );
+}
+
+// Optionally route delay() through HC::delay(), so that code running 
+// in a coroutine, such as a sub-sketch, sleeps on the timer wheel rather 
+// than yielding until the time is up. Define HC_DELAY_REDIRECT before 
+// including this to opt in.
+#ifdef HC_DELAY_REDIRECT
+#define delay(ms) HC::delay(ms)
+#endif
+
 /** 
  * \example flashing.ino
  * \example hopping.ino
  * \example dimmer.ino
+ * \example benchmark.ino
  */
  
 #endif
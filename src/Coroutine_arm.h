@@ -9,9 +9,15 @@
 #ifndef Coroutine_arm_h
 #define Coroutine_arm_h
 
-#include <csetjmp> 
+#include "HC_Config.h"
+
+#include <cstdint>
 #include <cstring>
 
+#ifdef HC_HOST_TEST
+// Built on a PC for the tests in test/host, which supply stand-ins
+#include "HostArm.h"
+#else
 namespace HC
 {
 namespace Arm
@@ -20,63 +26,85 @@ namespace Arm
 // This file contains low-level stuff for ARM only
 static_assert( __arm__==1 || __thumb__==1 );
 
-// We're assuming pointers and ints are the same size because the old
-// C library functions we use seem to assume it.
+// We're assuming pointers and ints are the same size because the 
+// context switching code seems to assume it.
 static_assert( sizeof(int) == sizeof(void *) );
 
-// Make sure the setjmp.h is the one we expect
-static_assert( sizeof(jmp_buf) == sizeof(int[23]) );
+/**
+ * Register context for a suspended thread of execution. 
+ * 
+ * Like a `jmp_buf`, only the "callee-save" registers are held, since 
+ * whoever called `switch_context()` will have saved anything else it 
+ * cares about. Unlike a `jmp_buf`, there is no room for floating point 
+ * or other state we don't need. Layout is known to Coroutine_arm.S.
+ */
+struct Context
+{
+  void *regs[10]; // r4-r11, sp, lr
+};
 
-// Jmp buf only holds "callee-save" registers
+// Context only holds "callee-save" registers
 static const int FIRST_CALLEE_SAVE = 4;
 
 // See http://infocenter.arm.com/help/topic/com.arm.doc.espc0002/ATPCS.pdf
-static const int JMPBUF_INDEX_SP = 12 - FIRST_CALLEE_SAVE; // r12
-static const int JMPBUF_INDEX_TR =  9 - FIRST_CALLEE_SAVE; // r9
-#if defined(__thumb__)
-// ATPCS says any of r4-r7 which would be problematic for us. But gcc
-// uses r7 by default, so this will work until you configure it otherwise.
-static const int JMPBUF_INDEX_FP =  7 - FIRST_CALLEE_SAVE; // r7
-#elif defined(__arm__)
-static const int JMPBUF_INDEX_FP = 11 - FIRST_CALLEE_SAVE; // r11
-#endif 
-
-inline void *get_jmp_buf_sp( const jmp_buf &env )
-{
-  return reinterpret_cast<void *>( env[JMPBUF_INDEX_SP] );
-}
+static const int CONTEXT_INDEX_TR =  9 - FIRST_CALLEE_SAVE; // r9
+static const int CONTEXT_INDEX_ENTRY_ARG =  4 - FIRST_CALLEE_SAVE; // r4
+static const int CONTEXT_INDEX_ENTRY_FUNCTION =  5 - FIRST_CALLEE_SAVE; // r5
+static const int CONTEXT_INDEX_SP =  8;
+static const int CONTEXT_INDEX_LR =  9;
 
-inline void set_jmp_buf_sp( jmp_buf &env, void *new_sp )
-{
-  env[JMPBUF_INDEX_SP] = reinterpret_cast<int>(new_sp);
-}
+/**
+ * Save the current context into `from` and switch to the context in 
+ * `to`. Returns when something switches back to `from`.
+ */
+void switch_context( Context *from, const Context *to ) asm ("hc_arm_switch_context");
 
-inline void *get_jmp_buf_tr( const jmp_buf &env )
+/**
+ * Entry point for contexts made by `prepare_entry_context()`. Not to be
+ * called directly.
+ */
+void context_entry() asm ("hc_arm_context_entry");
+
+/**
+ * Make a context that, when switched to, starts running a function on 
+ * a new stack. The function must not return. Other registers start 
+ * out zero.
+ * 
+ * @param context the context to fill in.
+ * @param stack_top highest address of the stack plus one; must be 
+ * 8-byte aligned.
+ * @param function the function to run.
+ * @param arg the argument to pass to the function.
+ */
+inline void prepare_entry_context( Context &context, void *stack_top, void (*function)(void *), void *arg )
 {
-  return reinterpret_cast<void *>( env[JMPBUF_INDEX_TR] );
+  memset( &context, 0, sizeof(context) );
+  context.regs[CONTEXT_INDEX_SP] = stack_top;
+  context.regs[CONTEXT_INDEX_LR] = (void *)&context_entry;
+  context.regs[CONTEXT_INDEX_ENTRY_ARG] = arg;
+  context.regs[CONTEXT_INDEX_ENTRY_FUNCTION] = (void *)function;
 }
 
-inline void set_jmp_buf_tr( jmp_buf &env, void *new_tr )
+inline void *get_context_sp( const Context &context )
 {
-  env[JMPBUF_INDEX_TR] = reinterpret_cast<int>(new_tr);
+  return context.regs[CONTEXT_INDEX_SP];
 }
 
-inline void *get_jmp_buf_fp( const jmp_buf &env )
+inline void set_context_sp( Context &context, void *new_sp )
 {
-  return reinterpret_cast<void *>( env[JMPBUF_INDEX_FP] );
+  context.regs[CONTEXT_INDEX_SP] = new_sp;
 }
 
-inline void set_jmp_buf_fp( jmp_buf &env, void *new_fp )
+inline void *get_context_tr( const Context &context )
 {
-  env[JMPBUF_INDEX_FP] = reinterpret_cast<int>(new_fp);
+  return context.regs[CONTEXT_INDEX_TR];
 }
 
-inline void copy_jmp_buf( jmp_buf &dest, const jmp_buf &src )
+inline void set_context_tr( Context &context, void *new_tr )
 {
-    memcpy( dest, src, sizeof(jmp_buf) );
+  context.regs[CONTEXT_INDEX_TR] = new_tr;
 }
 
-
 inline void *get_tr()
 {
     void *tr;
@@ -96,8 +124,86 @@ inline void *get_sp()
     return sp;
 }
 
-typedef int *jmp_buf_ptr;
+inline bool is_in_interrupt()
+{
+    uint32_t ipsr;
+    asm volatile( "mrs %[result], ipsr" : [result] "=r" (ipsr) : : );
+    return ipsr != 0;
+}
+
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+#define HC_ARM_HAVE_DWT
+#endif
+
+// System control space registers for cycle counting
+static volatile uint32_t * const SYST_RVR = (volatile uint32_t *)0xE000E014;
+static volatile uint32_t * const SYST_CVR = (volatile uint32_t *)0xE000E018;
+static volatile uint32_t * const DWT_CTRL = (volatile uint32_t *)0xE0001000;
+static volatile uint32_t * const DWT_CYCCNT = (volatile uint32_t *)0xE0001004;
+static volatile uint32_t * const DEMCR = (volatile uint32_t *)0xE000EDFC;
+
+/**
+ * Get a cycle counter for timing short intervals. Where there's a DWT
+ * (Cortex M3 and up) this is CYCCNT, which needs `enable_cycle_count()`.
+ * On Cortex M0/M0+ it is the SysTick current value, so intervals must 
+ * be shorter than a SysTick period. Use `get_cycles_between()` to 
+ * compare two readings.
+ */
+inline uint32_t get_cycle_count()
+{
+#ifdef HC_ARM_HAVE_DWT
+  return *DWT_CYCCNT;
+#else
+  return *SYST_CVR;
+#endif
+}
+
+inline uint32_t get_cycles_between( uint32_t start, uint32_t end )
+{
+#ifdef HC_ARM_HAVE_DWT
+  return end - start;
+#else
+  // SysTick counts down, and wraps back to the reload value
+  if( start >= end )
+    return start - end;
+  else
+    return start + (*SYST_RVR + 1) - end;
+#endif
+}
+
+inline void enable_cycle_count()
+{
+#ifdef HC_ARM_HAVE_DWT
+  *DEMCR |= 1U << 24; // TRCENA
+  *DWT_CTRL |= 1U; // CYCCNTENA
+#endif
+}
+
+/**
+ * Disable interrupts for the lifetime of the object, in RAII style. 
+ * The previous PRIMASK is restored, so these may be nested and may be 
+ * used from interrupt context. Cortex M0 has no LDREX/STREX so this is 
+ * how we do short read-modify-write sequences.
+ */
+class RAII_PRIMASK
+{
+public:
+  inline RAII_PRIMASK()
+  {
+    asm volatile( "mrs %[result], primask\n\t"
+                  "cpsid i" : [result] "=r" (previous_primask) : : "memory" );
+  }
+  
+  inline ~RAII_PRIMASK()
+  {
+    asm volatile( "msr primask, %[value]" : : [value] "r" (previous_primask) : "memory" );
+  }
+  
+private:
+  uint32_t previous_primask;
+};
 
 } } // namespace
+#endif
 
 #endif
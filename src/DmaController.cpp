@@ -0,0 +1,136 @@
+/**
+ * @file DmaController.cpp
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ */
+
+#include "DmaController.h"
+
+#include "Coroutine_arm.h"
+#include "Tracing.h"
+
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+using namespace HC;
+using namespace Arm;
+
+DmaController::DmaController( void (**vector_p_)() ) :
+  vector_p( vector_p_ ),
+  isr( this )
+{
+  for( int i=0; i<num_channels; i++ )
+  {
+    clients[i] = nullptr;
+    counts[i] = 0;
+  }
+  memset( descriptors, 0, sizeof(descriptors) );
+  memset( (void *)writeback, 0, sizeof(writeback) );
+}
+
+
+void DmaController::begin()
+{
+  RAII_PRIMASK lock;
+  *vector_p = isr;
+
+  PM->AHBMASK.reg |= PM_AHBMASK_DMAC;
+  PM->APBBMASK.reg |= PM_APBBMASK_DMAC;
+
+  // The reset and the new descriptor addresses would wipe out whoever
+  // enabled it, eg another instance or another library
+  HC_ASSERT( !(DMAC->CTRL.reg & DMAC_CTRL_DMAENABLE), "DMAC is already in use" );
+  DMAC->CTRL.reg = DMAC_CTRL_SWRST;
+  while( DMAC->CTRL.reg & DMAC_CTRL_SWRST );
+  DMAC->BASEADDR.reg = (uint32_t)(uintptr_t)descriptors;
+  DMAC->WRBADDR.reg = (uint32_t)(uintptr_t)writeback;
+  DMAC->CTRL.reg = DMAC_CTRL_DMAENABLE | DMAC_CTRL_LVLEN(0xf);
+
+  NVIC_EnableIRQ( DMAC_IRQn );
+}
+
+
+void DmaController::start( int channel, Client *client, uint8_t trigger,
+                           const volatile void *source, bool source_increment, 
+                           volatile void *dest, bool dest_increment, size_t count )
+{
+  HC_ASSERT( channel >= 0 && channel < num_channels, "bad DMA channel %d", channel );
+  HC_ASSERT( count > 0 && count <= 0xffff, "bad DMA count %d", count );
+
+  // Incrementing addresses are given as the end of the block
+  DmacDescriptor &desc = descriptors[channel];
+  desc.BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BLOCKACT_INT | DMAC_BTCTRL_BEATSIZE_BYTE |
+                    (source_increment ? DMAC_BTCTRL_SRCINC : 0) |
+                    (dest_increment ? DMAC_BTCTRL_DSTINC : 0);
+  desc.BTCNT.reg = count;
+  desc.SRCADDR.reg = (uint32_t)(uintptr_t)source + (source_increment ? count : 0);
+  desc.DSTADDR.reg = (uint32_t)(uintptr_t)dest + (dest_increment ? count : 0);
+  desc.DESCADDR.reg = 0;
+
+  RAII_PRIMASK lock;
+  clients[channel] = client;
+  counts[channel] = count;
+  
+  // So the count is right if we're stopped before the first beat
+  writeback[channel].BTCNT.reg = count;
+  
+  DMAC->CHID.reg = DMAC_CHID_ID(channel);
+  HC_ASSERT( !(DMAC->CHCTRLA.reg & DMAC_CHCTRLA_ENABLE), "DMA channel %d is busy", channel );
+  DMAC->CHCTRLA.reg = DMAC_CHCTRLA_SWRST;
+  while( DMAC->CHCTRLA.reg & DMAC_CHCTRLA_SWRST );
+  DMAC->CHCTRLB.reg = DMAC_CHCTRLB_LVL(0) | DMAC_CHCTRLB_TRIGSRC(trigger) | DMAC_CHCTRLB_TRIGACT_BEAT;
+  DMAC->CHINTENSET.reg = DMAC_CHINTENSET_TCMPL | DMAC_CHINTENSET_TERR;
+  DMAC->CHCTRLA.reg = DMAC_CHCTRLA_ENABLE;
+}
+
+
+void DmaController::stop( int channel )
+{
+  // The write-back descriptor is brought up to date when the channel 
+  // is disabled.
+  RAII_PRIMASK lock;
+  DMAC->CHID.reg = DMAC_CHID_ID(channel);
+  DMAC->CHCTRLA.reg &= ~DMAC_CHCTRLA_ENABLE;
+  while( DMAC->CHCTRLA.reg & DMAC_CHCTRLA_ENABLE );
+  DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_TCMPL | DMAC_CHINTFLAG_TERR;
+  clients[channel] = nullptr;
+}
+
+
+size_t DmaController::get_transferred( int channel ) const
+{
+  return counts[channel] - writeback[channel].BTCNT.reg;
+}
+
+
+void DmaController::handle_interrupt()
+{
+  // Channel selection is shared with thread code
+  RAII_PRIMASK lock;
+  while( DMAC->INTSTATUS.reg )
+  {
+    const int channel = DMAC->INTPEND.reg & DMAC_INTPEND_ID_Msk;
+    DMAC->CHID.reg = DMAC_CHID_ID(channel);
+    const uint8_t flags = DMAC->CHINTFLAG.reg;
+    DMAC->CHINTFLAG.reg = flags;
+    
+    Client * const client = clients[channel];
+    clients[channel] = nullptr;
+    if( client )
+      client->handle_dma_done( channel, flags & DMAC_CHINTFLAG_TERR );
+  }
+}
+
+
+DmaController::Isr::Isr( DmaController *controller_ ) :
+  controller( controller_ )
+{
+}
+
+
+void DmaController::Isr::operator()()
+{
+  controller->handle_interrupt();
+}
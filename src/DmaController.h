@@ -0,0 +1,131 @@
+/**
+ * @file DmaController.h
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ *
+ * @brief Shared access to the SAMD21 DMA controller
+ */
+#ifndef DmaController_h
+#define DmaController_h
+
+#if __cplusplus <= 199711L
+  #error This library needs at least a C++11 compliant compiler
+#endif
+
+#include "HC_Config.h"
+
+#include "SuperFunctor.h"
+
+#include <cstdint>
+#include <cstddef>
+#include "sam.h"
+
+namespace HC
+{
+
+/**
+ * @brief Runs single-block, peripheral-triggered transfers on DMAC 
+ * channels.
+ *
+ * The DMAC has one interrupt for all its channels, so there should be
+ * one instance, which dispatches to a client per channel. Declare the
+ * handler with `HC_INTERRUPT_HANDLER` so we can point it at ourselves,
+ * eg
+ *
+ * `HC_INTERRUPT_HANDLER(DMAC_Handler)`\n
+ * `HC::DmaController dma_controller( get_DMAC_Handler() );`\n
+ *
+ * Clients are told, from the interrupt, when their transfer completes 
+ * or fails. 
+ */
+class DmaController
+{
+public:
+  static const int num_channels = DMAC_CH_NUM;
+
+  /**
+   * @brief Interface for being told about the end of a transfer.
+   */
+  class Client
+  {
+  public:
+    /**
+     * Called from the DMAC interrupt when a transfer ends.
+     *
+     * @param channel the channel.
+     * @param error true if the transfer was stopped by a bus error.
+     */
+    virtual void handle_dma_done( int channel, bool error ) = 0;
+  };
+
+  /**
+   * Create an instance.
+   *
+   * @param vector_p_ the DMAC handler's re-direction pointer.
+   */
+  explicit DmaController( void (**vector_p_)() );
+
+  /**
+   * Clock, reset and enable the DMAC, and point the interrupt at us. 
+   * The DMAC must not already be enabled, since we take all of it.
+   */
+  void begin();
+
+  /**
+   * Start a transfer of bytes, one per trigger.
+   *
+   * @param channel the channel, which must not be busy.
+   * @param client told when the transfer ends.
+   * @param trigger the peripheral trigger, eg `SERCOM0_DMAC_ID_RX`.
+   * @param source the source address.
+   * @param source_increment true if the source is memory, not a register.
+   * @param dest the destination address.
+   * @param dest_increment true if the destination is memory, not a register.
+   * @param count number of bytes; 1 to 65535.
+   */
+  void start( int channel, Client *client, uint8_t trigger,
+              const volatile void *source, bool source_increment, 
+              volatile void *dest, bool dest_increment, size_t count );
+
+  /**
+   * Stop a transfer, if it's still going. The client is not called.
+   *
+   * @param channel the channel.
+   */
+  void stop( int channel );
+
+  /**
+   * Get the number of bytes transferred. Only valid once the transfer 
+   * has ended or been stopped.
+   *
+   * @param channel the channel.
+   */
+  size_t get_transferred( int channel ) const;
+
+private:
+  class Isr : public SuperFunctor
+  {
+  public:
+    explicit Isr( DmaController *controller_ );
+  protected:
+    void operator()();
+  private:
+    DmaController * const controller;
+  };
+
+  void handle_interrupt();
+  
+  void (** const vector_p)();
+  Isr isr;
+  Client *clients[num_channels];
+  uint16_t counts[num_channels];
+  
+  // The DMAC reads its descriptors from, and writes back to, these
+  DmacDescriptor descriptors[num_channels] __attribute__((aligned(16)));
+  volatile DmacDescriptor writeback[num_channels] __attribute__((aligned(16)));
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,185 @@
+/**
+ * @file Event.cpp
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ */
+
+#include "Event.h"
+
+#include "Coroutine_arm.h"
+
+#include <cstdint>
+
+using namespace std;
+using namespace HC;
+using namespace Arm;
+
+WaitQueue::WaitQueue() :
+  head( nullptr ),
+  tail( nullptr )
+{
+}
+
+
+void WaitQueue::push( Coroutine *waiter )
+{
+  HC_ASSERT( !waiter->parked, "coroutine %p is already waiting", waiter );
+  waiter->parked = true;
+  waiter->next_waiter = nullptr;
+  if( tail )
+    tail->next_waiter = waiter;
+  else
+    head = waiter;
+  tail = waiter;
+}
+
+
+Coroutine *WaitQueue::pop()
+{
+  Coroutine * const waiter = head;
+  if( !waiter )
+    return nullptr;
+  head = waiter->next_waiter;
+  if( !head )
+    tail = nullptr;
+  waiter->next_waiter = nullptr;
+  waiter->parked = false;
+  waiter->wake();
+  return waiter;
+}
+
+
+void WaitQueue::wake_all()
+{
+  while( pop() )
+  {
+  }
+}
+
+
+Event::Event() :
+  signal_count( 0 )
+{
+}
+
+
+void Event::wait()
+{
+  Coroutine * const waiter = me();
+  if( waiter )
+  {
+    {
+      RAII_PRIMASK lock;
+      push( waiter );
+    }
+    // Only resumed once we've been woken
+    Coroutine::yield();
+  }
+  else
+  {
+    const uint32_t initial_signal_count = signal_count;
+    while( signal_count == initial_signal_count )
+    {
+    }
+  }
+}
+
+
+void Event::signal()
+{
+  RAII_PRIMASK lock;
+  signal_count++;
+  wake_all();
+}
+
+
+Flag::Flag() :
+  flag( false )
+{
+}
+
+
+void Flag::wait()
+{
+  Coroutine * const waiter = me();
+  while( !flag )
+  {
+    if( waiter )
+    {
+      {
+        RAII_PRIMASK lock;
+        if( flag )
+          break;
+        push( waiter );
+      }
+      // Only resumed once we've been woken, but someone might have 
+      // cleared the flag since then, so go round again.
+      Coroutine::yield();
+    }
+  }
+}
+
+
+void Flag::set()
+{
+  RAII_PRIMASK lock;
+  flag = true;
+  wake_all();
+}
+
+
+void Flag::clear()
+{
+  flag = false;
+}
+
+
+Semaphore::Semaphore( int initial_count ) :
+  count( initial_count )
+{
+}
+
+
+void Semaphore::take()
+{
+  Coroutine * const waiter = me();
+  if( waiter )
+  {
+    {
+      RAII_PRIMASK lock;
+      if( count > 0 )
+      {
+        count--;
+        return;
+      }
+      push( waiter );
+    }
+    // Only resumed once give() has handed us a count
+    Coroutine::yield();
+  }
+  else
+  {
+    while( !try_take() )
+    {
+    }
+  }
+}
+
+
+bool Semaphore::try_take()
+{
+  RAII_PRIMASK lock;
+  if( count == 0 )
+    return false;
+  count--;
+  return true;
+}
+
+
+void Semaphore::give()
+{
+  RAII_PRIMASK lock;
+  if( !pop() )
+    count++;
+}
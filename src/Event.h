@@ -0,0 +1,177 @@
+/**
+ * @file Event.h
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ * 
+ * @brief Events, flags and semaphores that coroutines can wait on
+ */
+#ifndef Event_h
+#define Event_h
+
+#if __cplusplus <= 199711L
+  #error This library needs at least a C++11 compliant compiler
+#endif
+
+#include "HC_Config.h"
+
+#include "Coroutine.h"
+
+#include <cstdint>
+
+namespace HC
+{
+
+/**
+ * @brief Queue of coroutines waiting for something.
+ * 
+ * A coroutine on a wait queue is _parked_: invoking it returns 
+ * straight away without a context switch, until it is woken. So a 
+ * blocked coroutine costs almost nothing however often its invoker 
+ * (the loop, or an ISR it has hopped onto) runs.
+ * 
+ * The protected functions must be called with interrupts disabled.
+ */
+class WaitQueue
+{
+public:
+  WaitQueue();
+
+protected:
+  void push( Coroutine *waiter );
+  Coroutine *pop();
+  void wake_all();
+  
+private:
+  Coroutine *head;
+  Coroutine *tail;
+};
+
+
+/**
+ * @brief Something that happens, which coroutines can wait for.
+ * 
+ * `wait()` blocks until the next `signal()`, which wakes every waiting
+ * coroutine. A signal with nobody waiting is not remembered; use `Flag` 
+ * for that. `signal()` may be called from any context, including ISRs.
+ */
+class Event : private WaitQueue
+{
+public:
+  Event();
+  
+  /**
+   * Block until the event is next signalled. In a coroutine, this parks
+   * the coroutine; outside of any coroutine it spins.
+   */
+  void wait();
+  
+  /**
+   * Signal the event, waking all waiters. 
+   */
+  void signal();
+  
+private:
+  volatile uint32_t signal_count;
+};
+
+
+/**
+ * @brief A boolean that coroutines can wait to become set.
+ * 
+ * `set()` may be called from any context, including ISRs. The flag 
+ * stays set until cleared.
+ */
+class Flag : private WaitQueue
+{
+public:
+  Flag();
+  
+  /**
+   * Block until the flag is set. Returns immediately if it's already 
+   * set. In a coroutine, this parks the coroutine; outside of any 
+   * coroutine it spins. The flag is not cleared.
+   */
+  void wait();
+  
+  /**
+   * Set the flag, waking all waiters. 
+   */
+  void set();
+
+  /**
+   * Clear the flag. 
+   */
+  void clear();
+
+  /**
+   * Test the flag. 
+   */
+  inline bool is_set() const;
+  
+private:
+  volatile bool flag;
+};
+
+
+/**
+ * @brief Counting semaphore for coroutines.
+ * 
+ * `give()` may be called from any context, including ISRs. Waiters 
+ * are woken in the order they began waiting.
+ */
+class Semaphore : private WaitQueue
+{
+public:
+  /**
+   * Create an instance.
+   * 
+   * @param initial_count the number of times `take()` may succeed before
+   * a `give()` is needed.
+   */
+  explicit Semaphore( int initial_count = 0 );
+  
+  /**
+   * Take one count, blocking until one is available. In a coroutine, 
+   * this parks the coroutine; outside of any coroutine it spins.
+   */
+  void take();
+
+  /**
+   * Take one count if one is available. Never blocks.
+   * 
+   * @return true if a count was taken.
+   */
+  bool try_take();
+  
+  /**
+   * Give one count. If a coroutine is waiting, the count goes straight 
+   * to it and it is woken.
+   */
+  void give();
+  
+  /**
+   * Get the current count. 
+   */
+  inline int get_count() const;
+  
+private:
+  volatile int count;
+};
+
+// Implement the inline functions here
+
+bool Flag::is_set() const
+{
+  return flag;
+}
+
+
+int Semaphore::get_count() const
+{
+  return count;
+}
+
+} // namespace
+
+#endif
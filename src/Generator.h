@@ -0,0 +1,249 @@
+/**
+ * @file Generator.h
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ *
+ * @brief Typed generator built on coroutines
+ */
+#ifndef Generator_h
+#define Generator_h
+
+#if __cplusplus <= 199711L
+  #error This library needs at least a C++11 compliant compiler
+#endif
+
+#include "HC_Config.h"
+
+#include "Coroutine.h"
+#include "InplaceFunction.h"
+
+#include <utility>
+
+namespace HC
+{
+
+/**
+ * @brief Coroutine that produces a sequence of values.
+ *
+ * The body is given a reference to the generator, and calls
+ * `yield_value()` for each value it produces. The consumer gets each
+ * value by reference, directly from the body's stack, so values are
+ * never copied or buffered. A value is only valid until the consumer
+ * asks for the next one. The sequence ends when the body returns.
+ *
+ * The consumer can use `next()` and `value()`, or range-for, eg
+ *
+ * `HC::Generator<int> counter([](HC::Generator<int> &g)`\n
+ * `{`\n
+ * `  for( int i=0; i<10; i++ )`\n
+ * `    g.yield_value(i);`\n
+ * `});`\n
+ * `...`\n
+ * `for( int &i : counter )`\n
+ * `  Serial.println(i);`\n
+ *
+ * Since the body is stacked, it may call functions, to any depth,
+ * which call `yield_value()`. It may also `yield()` or `delay()`
+ * between values; see `next()`.
+ *
+ * A consumer that stops early, eg with `break` from a range-for, 
+ * leaves the body part way through. The body is cancelled when the 
+ * generator is destroyed; see `cancel()`.
+ *
+ * @tparam T type of the values produced.
+ */
+template<typename T>
+class Generator : public Coroutine
+{
+public:
+  /**
+   * Type of the body function.
+   */
+  typedef InplaceFunction<void(Generator &)> Body;
+
+  /**
+   * Iterator for range-for. Dereferences to the current value.
+   */
+  class iterator
+  {
+  public:
+    explicit iterator( Generator *generator_ ) :
+      generator( generator_ )
+    {
+    }
+
+    T &operator*() const
+    {
+      return generator->value();
+    }
+
+    T *operator->() const
+    {
+      return &generator->value();
+    }
+
+    iterator &operator++()
+    {
+      if( !generator->next() )
+        generator = nullptr;
+      return *this;
+    }
+
+    bool operator==( const iterator &other ) const
+    {
+      return generator == other.generator;
+    }
+
+    bool operator!=( const iterator &other ) const
+    {
+      return generator != other.generator;
+    }
+
+  private:
+    Generator *generator;
+  };
+
+  /**
+   * Create a generator with a heap-allocated stack.
+   *
+   * @param body_ the body function.
+   */
+  explicit Generator( Body body_ ) :
+    Coroutine( [this]{ call_body(); } ),
+    body( std::move(body_) ),
+    current( nullptr )
+  {
+  }
+
+  /**
+   * Create a generator with a stack taken from a pool.
+   *
+   * @param body_ the body function.
+   * @param pool pool to take the stack from.
+   */
+  Generator( Body body_, StackPool &pool ) :
+    Coroutine( [this]{ call_body(); }, pool ),
+    body( std::move(body_) ),
+    current( nullptr )
+  {
+  }
+
+  /**
+   * Create a generator with a stack supplied by the caller.
+   *
+   * @param body_ the body function.
+   * @param stack_memory the stack.
+   * @param stack_size_ size of the stack in bytes.
+   */
+  Generator( Body body_, byte *stack_memory, int stack_size_ ) :
+    Coroutine( [this]{ call_body(); }, stack_memory, stack_size_ ),
+    body( std::move(body_) ),
+    current( nullptr )
+  {
+  }
+
+  ~Generator()
+  {
+    cancel();
+  }
+
+  /**
+   * End the sequence without running the rest of the body. The body's 
+   * frames are abandoned rather than unwound, so objects on its stack 
+   * are not destructed; a body that might be cancelled should not hold
+   * anything across `yield_value()` that needs releasing. It must not 
+   * be waiting on an Event etc or inside a Hopper when cancelled. Does
+   * nothing once the sequence has ended.
+   *
+   * Must be called from outside the body.
+   */
+  void cancel()
+  {
+    current = nullptr;
+    abandon();
+  }
+
+  /**
+   * Hand a value to the consumer and wait until it asks for the next
+   * one. Must be called from within the generator's body.
+   *
+   * @param v the value, which stays where it is.
+   */
+  void yield_value( T &v )
+  {
+    HC_ASSERT( me() == this, "yield_value() called outside the generator's body" );
+    current = &v;
+    yield();
+  }
+
+  /**
+   * Hand a temporary value to the consumer and wait until it asks for
+   * the next one. The temporary lives until we return, so this is safe.
+   *
+   * @param v the value.
+   */
+  void yield_value( T &&v )
+  {
+    yield_value( v );
+  }
+
+  /**
+   * Run the body until it yields the next value or returns. If the body
+   * yields without a value, we yield too, so a consumer that is itself
+   * a coroutine lets other work run while it waits.
+   *
+   * @return true if there is a new value, false at the end of the
+   * sequence.
+   */
+  bool next()
+  {
+    current = nullptr;
+    while(1)
+    {
+      (*this)();
+      if( current )
+        return true;
+      if( is_complete() )
+        return false;
+      Coroutine::yield();
+    }
+  }
+
+  /**
+   * Get the current value. Only valid after `next()` returned true.
+   */
+  T &value() const
+  {
+    return *current;
+  }
+
+  /**
+   * Start the sequence and get an iterator to the first value.
+   */
+  iterator begin()
+  {
+    return iterator( next() ? this : nullptr );
+  }
+
+  /**
+   * Get the end-of-sequence iterator.
+   */
+  iterator end()
+  {
+    return iterator( nullptr );
+  }
+
+private:
+  void call_body()
+  {
+    body( *this );
+  }
+
+  Body body;
+  T *current;
+};
+
+} // namespace
+
+#endif
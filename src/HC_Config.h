@@ -0,0 +1,61 @@
+/**
+ * @file HC_Config.h
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ *
+ * @brief Build options for the library
+ *
+ * Options that change the layout of the library's classes are set here
+ * and nowhere else. Every library header includes this first, so the
+ * library and the sketch always agree on them. Defining one of these
+ * in a sketch instead gives a link error rather than two different
+ * layouts of the same class.
+ *
+ * This is also included by the assembler sources, so it must only
+ * contain preprocessor definitions outside the `__cplusplus` part.
+ */
+#ifndef HC_Config_h
+#define HC_Config_h
+
+// Define this to use the toolchain's native TLS for coroutine-local
+// storage, instead of replacing emutls. Needs -fno-emulated-tls and a
+// linker script that provides __tdata_source, __tdata_size,
+// __tbss_size and __tls_align (as picolibc's does).
+//#define HC_NATIVE_TLS
+
+// Define this to measure, for each coroutine, the time from interrupt
+// entry to resuming and the time spent in interrupts before yielding.
+// See HopStats.h.
+//#define HC_HOP_STATS
+
+// Capacity of the ring buffer used by HC::Uart's `BUFFERED_RECEIVE`; 
+// must be a power of 2
+#define HC_UART_RX_RING_SIZE 128
+
+#ifdef __cplusplus
+namespace HC
+{
+namespace Config
+{
+// Each file that includes us refers to the symbol for the options it
+// was built with. The library only defines the ones it was built with.
+#ifdef HC_NATIVE_TLS
+extern const int native_tls_on;
+static const int * const native_tls_check __attribute__((used)) = &native_tls_on;
+#else
+extern const int native_tls_off;
+static const int * const native_tls_check __attribute__((used)) = &native_tls_off;
+#endif
+#ifdef HC_HOP_STATS
+extern const int hop_stats_on;
+static const int * const hop_stats_check __attribute__((used)) = &hop_stats_on;
+#else
+extern const int hop_stats_off;
+static const int * const hop_stats_check __attribute__((used)) = &hop_stats_off;
+#endif
+} // namespace
+} // namespace
+#endif
+
+#endif
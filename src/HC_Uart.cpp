@@ -7,57 +7,286 @@
 
 #include "HC_Uart.h"
 
+#include "Coroutine_arm.h"
+
 #include <functional>
 #include <atomic>
+#include <algorithm>
 
 using namespace std;
 using namespace HC;
+using namespace Arm;
+
+// Tells the linker which way we were built; see HC_Config.h
+const int HC::Config::HC_CONFIG_RX_RING_CHECK(HC_UART_RX_RING_SIZE) = 1;
 
 HC::Uart::Uart(SERCOM *_s, void (**_vector_p)(), uint8_t _pinRX, uint8_t _pinTX, SercomRXPad _padRX, SercomUartTXPad _padTX) :
   ::Uart( _s, _pinRX, _pinTX, _padRX, _padTX ),
   sercom( _s ),
-  vector_p( _vector_p )
+  vector_p( _vector_p ),
+  vector_coroutine( nullptr ),
+  vector_hopper( nullptr ),
+  receive_mode( HOPPED_RECEIVE ),
+  isr( this ),
+  dma_client( this ),
+  dma_controller( nullptr ),
+  rx_channel( 0 ),
+  hw( nullptr ),
+  rx_trigger( 0 ),
+  rx_enabled( false ),
+  rx_data( 0 ),
+  rx_error( NO_ERROR ),
+  rx_block( nullptr ),
+  rx_block_size( 0 ),
+  rx_block_count( 0 ),
+  rx_idle_timer(),
+  rx_threshold( HC_UART_RX_RING_SIZE/2 ),
+  rx_watermark( HC_UART_RX_RING_SIZE/2 ),
+  rx_idle_ms( 0 ),
+  rx_last_tick( 0 ),
+  rx_idle_wanted( false ),
+  adaptive_scheduler( nullptr ),
+  adaptive_irqn( (IRQn_Type)0 ),
+  busy_gap_us( 0 ),
+  busy_count( 0 ),
+  idle_us( 0 ),
+  polling( false ),
+  busy_run( 0 ),
+  last_receive_us( 0 ),
+  polling_task( nullptr ),
+  to_polling_hop( [this]{ hop_to_polling(); } ),
+  to_interrupt_hop( [this]{ hop_to_interrupt(); } ),
+  tx_channel( -1 ),
+  tx_trigger( 0 ),
+  tx_enabled( false ),
+  tx_busy( false ),
+  tx_dma_error( false ),
+  tx_block( nullptr ),
+  tx_block_size( 0 ),
+  tx_block_count( 0 )
 {
+  reset_adaptive_stats();
 }
  
   
 HC::Uart::Uart(SERCOM *_s, void (**_vector_p)(), uint8_t _pinRX, uint8_t _pinTX, SercomRXPad _padRX, SercomUartTXPad _padTX, uint8_t _pinRTS, uint8_t _pinCTS) :
   ::Uart( _s, _pinRX, _pinTX, _padRX, _padTX, _pinRTS, _pinCTS ),
   sercom( _s ),
-  vector_p( _vector_p )
+  vector_p( _vector_p ),
+  vector_coroutine( nullptr ),
+  vector_hopper( nullptr ),
+  receive_mode( HOPPED_RECEIVE ),
+  isr( this ),
+  dma_client( this ),
+  dma_controller( nullptr ),
+  rx_channel( 0 ),
+  hw( nullptr ),
+  rx_trigger( 0 ),
+  rx_enabled( false ),
+  rx_data( 0 ),
+  rx_error( NO_ERROR ),
+  rx_block( nullptr ),
+  rx_block_size( 0 ),
+  rx_block_count( 0 ),
+  rx_idle_timer(),
+  rx_threshold( HC_UART_RX_RING_SIZE/2 ),
+  rx_watermark( HC_UART_RX_RING_SIZE/2 ),
+  rx_idle_ms( 0 ),
+  rx_last_tick( 0 ),
+  rx_idle_wanted( false ),
+  adaptive_scheduler( nullptr ),
+  adaptive_irqn( (IRQn_Type)0 ),
+  busy_gap_us( 0 ),
+  busy_count( 0 ),
+  idle_us( 0 ),
+  polling( false ),
+  busy_run( 0 ),
+  last_receive_us( 0 ),
+  polling_task( nullptr ),
+  to_polling_hop( [this]{ hop_to_polling(); } ),
+  to_interrupt_hop( [this]{ hop_to_interrupt(); } ),
+  tx_channel( -1 ),
+  tx_trigger( 0 ),
+  tx_enabled( false ),
+  tx_busy( false ),
+  tx_dma_error( false ),
+  tx_block( nullptr ),
+  tx_block_size( 0 ),
+  tx_block_count( 0 )
 {
+  reset_adaptive_stats();
 }
 
 
 void HC::Uart::begin(unsigned long baudRate)
 {
-  if( vector_p )
-    *vector_p = *me();
+  attach_vector();
   ::Uart::begin(baudRate);
+  configure_receive();
+  tx_enabled = true;
 }
 
 
 void HC::Uart::begin(unsigned long baudrate, uint16_t config)
 {
-  if( vector_p )
-    *vector_p = *me();
+  attach_vector();
   ::Uart::begin(baudrate, config);
+  configure_receive();
+  tx_enabled = true;
 }
 
 
 void HC::Uart::end()
 {
+  {
+    // Stop any blocks going on, and wake whoever is waiting for them
+    RAII_PRIMASK lock;
+    if( rx_block && receive_mode == DMA_RECEIVE )
+    {
+      dma_controller->stop( rx_channel );
+      rx_block_count += dma_controller->get_transferred( rx_channel );
+    }
+    rx_block = nullptr;
+    rx_flag.set();
+    rx_enabled = false;
+    tx_enabled = false;
+    if( tx_channel >= 0 )
+      dma_controller->stop( tx_channel );
+    sercom->disableDataRegisterEmptyInterruptUART();
+    tx_block = nullptr;
+    tx_flag.set();
+  }
+  if( polling_task )
+  {
+    // Stop polling, and leave the interrupt as ::Uart expects it
+    adaptive_scheduler->detach( *polling_task );
+    polling_task = nullptr;
+    NVIC_EnableIRQ( adaptive_irqn );
+  }
+  polling = false;
+  busy_run = 0;
   ::Uart::end();
   if( vector_p )
     *vector_p = nullptr;
+  vector_coroutine = nullptr;
+  vector_hopper = nullptr;
+  end_receive();
+}
+
+
+void HC::Uart::set_receive_mode( ReceiveMode mode )
+{
+  receive_mode = mode;
+}
+
+
+void HC::Uart::set_dma( DmaController *dma_controller_, int rx_channel_, Sercom *hw_, uint8_t rx_trigger_ )
+{
+  dma_controller = dma_controller_;
+  rx_channel = rx_channel_;
+  hw = hw_;
+  rx_trigger = rx_trigger_;
+}
+
+
+void HC::Uart::set_adaptive( Scheduler *scheduler_, IRQn_Type irqn_, uint32_t busy_gap_us_, 
+                             int busy_count_, uint32_t idle_us_ )
+{
+  HC_ASSERT( !polling, "cannot change adaptive settings while polling" );
+  adaptive_scheduler = scheduler_;
+  adaptive_irqn = irqn_;
+  busy_gap_us = busy_gap_us_;
+  busy_count = busy_count_;
+  idle_us = idle_us_;
+}
+
+
+void HC::Uart::request_adaptive_hop( const Task::HopLambda *hop )
+{
+  // The hop slot is shared with the Hopper we're in. We've yielded since
+  // it last asked for a hop, which took the request, so the slot is 
+  // free. If the Hopper asks again before we next yield, it replaces 
+  // ours, which is what we want, since it has moved us; we see that 
+  // once we're resumed.
+  HC_ASSERT( !me()->is_hop_pending(), "hop already pending" );
+  me()->set_hop( hop );
+}
+
+
+void HC::Uart::hop_to_polling()
+{
+  // Not if end() got in first
+  if( !polling || polling_task )
+    return;
+  NVIC_DisableIRQ( adaptive_irqn );
+  polling_task = me();
+  adaptive_scheduler->attach( *polling_task );
+}
+
+
+void HC::Uart::hop_to_interrupt()
+{
+  if( polling || !polling_task )
+    return;
+  adaptive_scheduler->detach( *polling_task );
+  polling_task = nullptr;
+  NVIC_EnableIRQ( adaptive_irqn );
+}
+
+
+void HC::Uart::reset_adaptive_stats()
+{
+  adaptive_stats.to_polling_count = 0;
+  adaptive_stats.to_interrupt_count = 0;
+}
+
+
+void HC::Uart::set_rx_watermark( int watermark )
+{
+  HC_ASSERT( watermark > 0 && watermark <= HC_UART_RX_RING_SIZE, "bad watermark %d", watermark );
+  rx_watermark = watermark;
+}
+
+
+void HC::Uart::set_rx_idle_time( uint32_t ms )
+{
+  rx_idle_ms = ms;
+}
+
+
+void HC::Uart::set_tx_dma( DmaController *dma_controller_, int tx_channel_, Sercom *hw_, uint8_t tx_trigger_ )
+{
+  dma_controller = dma_controller_;
+  tx_channel = tx_channel_;
+  hw = hw_;
+  tx_trigger = tx_trigger_;
 }
 
 
 int HC::Uart::read( Error *error_p )
 {
+  if( receive_mode == DMA_RECEIVE || receive_mode == BUFFERED_RECEIVE )
+  {
+    uint8_t data;
+    if( read( &data, 1, error_p ) == 0 )
+      return 0;
+    return data;
+  }
+  
+  if( receive_mode == EVENT_RECEIVE )
+  {
+    rx_flag.wait();
+    RAII_PRIMASK lock;
+    if( error_p )
+      *error_p = rx_error;
+    rx_error = NO_ERROR;
+    rx_flag.clear();
+    return rx_data;
+  }
+    
   if( error_p )
     *error_p = NO_ERROR;
-  wait( [=]{ return sercom->isUARTError() || sercom->availableDataUART(); } );
+  wait_for_receive();
 
   if(sercom->isUARTError())
   {
@@ -69,6 +298,616 @@ int HC::Uart::read( Error *error_p )
 }
 
 
+size_t HC::Uart::read( uint8_t *buffer, size_t size, Error *error_p )
+{
+  if( error_p )
+    *error_p = NO_ERROR;
+  if( size == 0 )
+    return 0;
+    
+  switch( receive_mode )
+  {
+    case HOPPED_RECEIVE:
+      return read_block_hopped( buffer, size, error_p );
+    case BUFFERED_RECEIVE:
+      return read_block_buffered( buffer, size, error_p, false );
+    default:
+      return read_block_parked( buffer, size, error_p );
+  }
+}
+
+
+size_t HC::Uart::read_available( uint8_t *buffer, size_t size, Error *error_p )
+{
+  if( receive_mode != BUFFERED_RECEIVE )
+    return read( buffer, size, error_p );
+    
+  if( error_p )
+    *error_p = NO_ERROR;
+  if( size == 0 )
+    return 0;
+  return read_block_buffered( buffer, size, error_p, true );
+}
+
+
+size_t HC::Uart::read_block_hopped( uint8_t *buffer, size_t size, Error *error_p )
+{
+  size_t count = 0;
+  while( count < size )
+  {
+    wait_for_receive();
+    if( sercom->isUARTError() )
+    {
+      handle_UART_error( error_p );
+      break;
+    }
+    buffer[count++] = sercom->readDataUART();
+  }
+  return count;
+}
+
+
+void HC::Uart::wait_for_receive()
+{
+  if( adaptive_scheduler )
+    wait_for_receive_adaptive();
+  else
+    wait( [=]{ return sercom->isUARTError() || sercom->availableDataUART(); } );
+}
+
+
+void HC::Uart::wait_for_receive_adaptive()
+{
+  // Our hops attach us to the scheduler and back underneath the hop 
+  // that began the port, so we must still be in it. Not checked once
+  // ended, since we'll never hop then.
+  Coroutine * const coroutine = me();
+  HC_ASSERT( !vector_coroutine || 
+             (coroutine == vector_coroutine && coroutine->get_current_hopper() == vector_hopper),
+             "adaptive receive outside the hop that called begin()" );
+  while( true )
+  {
+    yield();
+    if( polling && !polling_task )
+    {
+      // A Hopper replaced our hop to polling before it could run
+      polling = false;
+    }
+    const bool ready = sercom->isUARTError() || sercom->availableDataUART();
+    const uint32_t now = micros();
+    if( polling )
+    {
+      if( ready )
+      {
+        last_receive_us = now;
+        return;
+      }
+      if( now - last_receive_us >= idle_us )
+      {
+        // Quiet: go back to waiting for the interrupt
+        polling = false;
+        adaptive_stats.to_interrupt_count++;
+        request_adaptive_hop( &to_interrupt_hop );
+      }
+    }
+    else if( ready )
+    {
+      if( now - last_receive_us < busy_gap_us )
+        busy_run++;
+      else
+        busy_run = 0;
+      last_receive_us = now;
+      if( busy_run >= busy_count )
+      {
+        // Busy: poll from the scheduler instead
+        polling = true;
+        busy_run = 0;
+        adaptive_stats.to_polling_count++;
+        request_adaptive_hop( &to_polling_hop );
+      }
+      return;
+    }
+  }
+}
+
+
+size_t HC::Uart::read_block_parked( uint8_t *buffer, size_t size, Error *error_p )
+{
+  Error error = NO_ERROR;
+  size_t count = 0;
+  bool started = false;
+  {
+    RAII_PRIMASK lock;
+    if( rx_enabled && rx_flag.is_set() )
+    {
+      // Take what came in before we asked
+      error = rx_error;
+      rx_error = NO_ERROR;
+      rx_flag.clear();
+      if( error == NO_ERROR )
+        buffer[count++] = rx_data;
+    }
+    
+    if( error == NO_ERROR && count < size && rx_enabled )
+    {
+      // Hand the rest of the buffer over to the ISR or DMAC
+      rx_block = buffer;
+      rx_block_size = size;
+      rx_block_count = count;
+      if( receive_mode == DMA_RECEIVE )
+        dma_controller->start( rx_channel, &dma_client, rx_trigger, 
+                               &hw->USART.DATA.reg, false, buffer + count, true, size - count );
+      started = true;
+    }
+  }
+  
+  if( started )
+  {
+    rx_flag.wait();
+    RAII_PRIMASK lock;
+    count = rx_block_count;
+    error = rx_error;
+    rx_error = NO_ERROR;
+    rx_flag.clear();
+  }
+  
+  if( error_p )
+    *error_p = error;
+  return count;
+}
+
+
+size_t HC::Uart::read_block_buffered( uint8_t *buffer, size_t size, Error *error_p, bool available )
+{
+  TimerWheel &wheel = get_system_timer_wheel();
+  Flag &wake = rx_idle_timer.expired;
+  Error error = NO_ERROR;
+  size_t count = 0;
+  while( true )
+  {
+    // Everything in the ring came before any error
+    while( count < size && rx_ring.try_receive( buffer[count] ) )
+      count++;
+    if( count == size )
+      break;
+      
+    {
+      RAII_PRIMASK lock;
+      if( !rx_enabled )
+        break;
+      if( rx_error && rx_ring.is_empty() )
+      {
+        error = rx_error;
+        rx_error = NO_ERROR;
+        break;
+      }
+      
+      // With no idle time, we're done after the first drain
+      if( available && count > 0 && 
+          (!rx_idle_ms || wheel.get_now() - rx_last_tick >= rx_idle_ms) )
+        break;
+        
+      // Wait for enough to be worth waking for; if we already have 
+      // some, that includes the line going idle.
+      const int needed = available ? 1 : size - count;
+      rx_threshold = needed < rx_watermark ? needed : rx_watermark;
+      if( available && count > 0 )
+        rx_threshold = rx_watermark;
+      rx_idle_wanted = available && rx_idle_ms;
+      if( rx_error || rx_ring.count() >= rx_threshold )
+        continue;
+      wake.clear();
+      if( rx_idle_wanted && count > 0 && 
+          (int32_t)(rx_idle_timer.expiry - wheel.get_now()) <= 0 )
+      {
+        rx_idle_timer.expiry = rx_last_tick + rx_idle_ms;
+        if( !wheel.add( rx_idle_timer ) )
+          break; // already idle
+      }
+    }
+    wake.wait();
+  }
+  
+  rx_idle_wanted = false;
+  if( error_p )
+    *error_p = error;
+  return count;
+}
+
+
+size_t HC::Uart::write( const uint8_t *buffer, size_t size )
+{
+  if( size == 0 )
+    return 0;
+  if( !me() )
+    return write_block_polled( buffer, size );
+  if( receive_mode == HOPPED_RECEIVE )
+    return write_block_hopped( buffer, size );
+  else
+    return write_block_parked( buffer, size );
+}
+
+
+size_t HC::Uart::write( uint8_t data )
+{
+  return write( &data, 1 );
+}
+
+
+bool HC::Uart::try_write_direct( uint8_t data )
+{
+  // Not while the ISR or DMAC is sending a block, or we'd get in among
+  // its characters
+  RAII_PRIMASK lock;
+  if( tx_busy || !sercom->isDataRegisterEmptyUART() )
+    return false;
+  sercom->writeDataUART( data );
+  return true;
+}
+
+
+bool HC::Uart::claim_transmit()
+{
+  RAII_PRIMASK lock;
+  if( tx_busy )
+    return false;
+  tx_busy = true;
+  return true;
+}
+
+
+size_t HC::Uart::write_block_polled( const uint8_t *buffer, size_t size )
+{
+  for( size_t i=0; i<size; i++ )
+  {
+    while( !try_write_direct( buffer[i] ) )
+    {
+      if( !tx_enabled )
+        return i;
+    }
+  }
+  return size;
+}
+
+
+bool HC::Uart::is_on_vector() const
+{
+  // begin() put us on the SERCOM interrupt from within a hop, and we 
+  // haven't hopped anywhere else since, or over to polling
+  Coroutine * const coroutine = me();
+  return coroutine && coroutine == vector_coroutine &&
+         coroutine->get_current_hopper() == vector_hopper && !polling_task;
+}
+
+
+size_t HC::Uart::write_block_hopped( const uint8_t *buffer, size_t size )
+{
+  // If we're the coroutine on the SERCOM interrupt, DRE will resume us.
+  // Any other coroutine must not turn DRE on: it would keep resuming 
+  // the one on the interrupt, which would never let us run. So we poll.
+  // We may hop on or off the interrupt whenever we yield, so look again
+  // each time.
+  bool dre_enabled = false;
+  size_t count = 0;
+  while( count < size && tx_enabled )
+  {
+    if( try_write_direct( buffer[count] ) )
+    {
+      count++;
+      continue;
+    }
+    const bool on_vector = is_on_vector();
+    if( on_vector && !dre_enabled )
+      sercom->enableDataRegisterEmptyInterruptUART();
+    else if( !on_vector && dre_enabled )
+      sercom->disableDataRegisterEmptyInterruptUART();
+    dre_enabled = on_vector;
+    yield();
+  }
+  if( dre_enabled )
+    sercom->disableDataRegisterEmptyInterruptUART();
+  return count;
+}
+
+
+size_t HC::Uart::write_block_parked( const uint8_t *buffer, size_t size )
+{
+  // One block at a time
+  bool claimed = claim_transmit();
+  if( !claimed )
+    wait( [&]{ return (claimed = claim_transmit()) || !tx_enabled; } );
+  if( !claimed )
+    return 0;
+    
+  size_t done = 0;
+  if( tx_channel >= 0 )
+  {
+    // The DMAC can do up to 65535 at a time
+    while( done < size )
+    {
+      const size_t count = min( size - done, (size_t)0xffff );
+      {
+        RAII_PRIMASK lock;
+        if( !tx_enabled )
+          break;
+        tx_flag.clear();
+        tx_dma_error = false;
+        dma_controller->start( tx_channel, &dma_client, tx_trigger, 
+                               buffer + done, true, &hw->USART.DATA.reg, false, count );
+      }
+      tx_flag.wait();
+      if( !tx_enabled || tx_dma_error )
+      {
+        // end() stopped the DMAC part way, or a bus error did
+        done += dma_controller->get_transferred( tx_channel );
+        break;
+      }
+      done += count;
+    }
+  }
+  else
+  {
+    bool started = false;
+    {
+      RAII_PRIMASK lock;
+      tx_block_count = 0;
+      if( tx_enabled )
+      {
+        tx_flag.clear();
+        tx_block = buffer;
+        tx_block_size = size;
+        sercom->enableDataRegisterEmptyInterruptUART();
+        started = true;
+      }
+    }
+    if( started )
+      tx_flag.wait();
+    done = tx_block_count;
+  }
+  
+  tx_busy = false;
+  return done;
+}
+
+
+void HC::Uart::attach_vector()
+{
+  if( !vector_p )
+    return;
+    
+  switch( receive_mode )
+  {
+    case HOPPED_RECEIVE: {
+      vector_coroutine = me();
+      vector_hopper = vector_coroutine->get_current_hopper();
+      *vector_p = *vector_coroutine;
+      break;
+    }
+    case EVENT_RECEIVE: 
+    case DMA_RECEIVE: 
+    case BUFFERED_RECEIVE: {
+      *vector_p = isr;
+      break;
+    }
+  }
+}
+
+
+void HC::Uart::configure_receive()
+{
+  // end() leaves the flag set, to wake any reader
+  rx_flag.clear();
+  rx_enabled = true;
+  
+  if( receive_mode != DMA_RECEIVE )
+    return;
+    
+  // The DMAC takes the characters; we only want to hear about errors
+  HC_ASSERT( dma_controller && hw, "DMA receive without set_dma()" );
+  hw->USART.INTENCLR.reg = SERCOM_USART_INTENCLR_RXC;
+}
+
+
+void HC::Uart::end_receive()
+{
+  // Now the ISR is off, leave nothing behind for the next begin(): no
+  // characters or error in the ring, and no idle timer on the wheel. 
+  // Then wake any reader in BUFFERED_RECEIVE, which will see that 
+  // we've ended.
+  TimerWheel &wheel = get_system_timer_wheel();
+  RAII_PRIMASK lock;
+  wheel.remove( rx_idle_timer );
+  rx_idle_timer.expiry = wheel.get_now();
+  rx_idle_wanted = false;
+  rx_ring.clear();
+  rx_error = NO_ERROR;
+  rx_idle_timer.expired.set();
+}
+
+
+void HC::Uart::handle_interrupt()
+{
+  if( receive_mode == DMA_RECEIVE )
+  {
+    handle_interrupt_dma();
+    return;
+  }
+  if( receive_mode == BUFFERED_RECEIVE )
+  {
+    handle_interrupt_buffered();
+    return;
+  }
+  
+  // Deal with receive. If there's a block read going on, the character 
+  // goes into it. Otherwise, if the last character hasn't been read 
+  // yet, this one replaces it and we report an overrun.
+  if( sercom->isUARTError() )
+  {
+    Error error = NO_ERROR;
+    handle_UART_error( &error );
+    if( rx_block )
+    {
+      end_block( error );
+    }
+    else
+    {
+      rx_error = (Error)(rx_error | error);
+      rx_data = 0;
+      rx_flag.set();
+    }
+  }
+  else if( sercom->availableDataUART() )
+  {
+    const uint8_t data = sercom->readDataUART();
+    if( rx_block )
+    {
+      rx_block[rx_block_count++] = data;
+      if( rx_block_count == rx_block_size )
+        end_block( NO_ERROR );
+    }
+    else
+    {
+      if( rx_flag.is_set() )
+        rx_error = (Error)(rx_error | OVERRUN_ERROR);
+      rx_data = data;
+      rx_flag.set();
+    }
+  }
+  
+  handle_transmit();
+}
+
+
+void HC::Uart::handle_interrupt_dma()
+{
+  // The DMAC races the SERCOM ISR for characters, and does not know 
+  // about errors, so stop it and see how far it got.
+  if( sercom->isUARTError() )
+  {
+    RAII_PRIMASK lock;
+    Error error = NO_ERROR;
+    if( rx_block )
+    {
+      dma_controller->stop( rx_channel );
+      size_t count = rx_block_count + dma_controller->get_transferred( rx_channel );
+      const bool taken = !sercom->availableDataUART();
+      handle_UART_error( &error );
+      
+      // A character with a frame error is taken like any other, unless
+      // we got in before the DMAC did
+      if( (error & FRAME_ERROR) && taken && count > rx_block_count )
+        count--;
+      rx_block_count = count;
+      end_block( error );
+    }
+    else
+    {
+      // Nobody is asking, so there's nobody to tell
+      handle_UART_error( &error );
+    }
+  }
+  
+  // Only transmit is left. ::Uart's handler must not run here, because
+  // it would take any character the DMAC hasn't got to yet.
+  handle_transmit();
+}
+
+
+void HC::Uart::handle_interrupt_buffered()
+{
+  // Once there's an error, drop characters until it's been reported, 
+  // so that the ring only holds what came before it.
+  if( sercom->isUARTError() )
+  {
+    Error error = NO_ERROR;
+    handle_UART_error( &error );
+    rx_error = (Error)(rx_error | error);
+  }
+  else if( sercom->availableDataUART() )
+  {
+    const uint8_t data = sercom->readDataUART();
+    if( !rx_error && !rx_ring.try_send( data ) )
+      rx_error = OVERRUN_ERROR;
+      
+    TimerWheel &wheel = get_system_timer_wheel();
+    rx_last_tick = wheel.get_now();
+    if( rx_idle_wanted && (int32_t)(rx_idle_timer.expiry - rx_last_tick) <= 0 )
+    {
+      rx_idle_timer.expiry = rx_last_tick + rx_idle_ms;
+      wheel.add( rx_idle_timer );
+    }
+  }
+  
+  if( rx_error || rx_ring.count() >= rx_threshold )
+    rx_idle_timer.expired.set();
+  
+  handle_transmit();
+}
+
+
+void HC::Uart::handle_transmit()
+{
+  // All writes come through us, so ::Uart's transmit buffer is never 
+  // used and its handler has nothing to do. The DRE interrupt is only
+  // on while we're sending a block.
+  if( !tx_block )
+    return;
+  
+  if( sercom->isDataRegisterEmptyUART() )
+  {
+    sercom->writeDataUART( tx_block[tx_block_count++] );
+    if( tx_block_count == tx_block_size )
+    {
+      sercom->disableDataRegisterEmptyInterruptUART();
+      tx_block = nullptr;
+      tx_flag.set();
+    }
+  }
+}
+
+
+void HC::Uart::end_block( Error error )
+{
+  rx_block = nullptr;
+  rx_error = (Error)(rx_error | error);
+  rx_flag.set();
+}
+
+
+HC::Uart::DmaClient::DmaClient( Uart *uart_ ) :
+  uart( uart_ )
+{
+}
+
+
+void HC::Uart::DmaClient::handle_dma_done( int channel, bool error )
+{
+  if( channel == uart->tx_channel )
+  {
+    uart->tx_dma_error = error;
+    uart->tx_flag.set();
+    return;
+  }
+  
+  if( !uart->rx_block )
+    return;
+  uart->rx_block_count += uart->dma_controller->get_transferred( channel );
+  uart->end_block( error ? DMA_ERROR : NO_ERROR );
+}
+
+
+HC::Uart::Isr::Isr( Uart *uart_ ) :
+  uart( uart_ )
+{
+}
+
+
+void HC::Uart::Isr::operator()()
+{
+  uart->handle_interrupt();
+}
+
+
 void HC::Uart::handle_UART_error( Error *error_p )
 {
   sercom->acknowledgeUARTError();
@@ -80,7 +919,10 @@ void HC::Uart::handle_UART_error( Error *error_p )
 
     sercom->clearFrameErrorUART();
   }  
-  // TODO: if (sercom->isBufferOverflowErrorUART()) ....
+  if (sercom->isBufferOverflowErrorUART()) {
+    if( error_p )
+      *error_p = (Error)(*error_p | OVERRUN_ERROR);
+  }
   // TODO: if (sercom->isParityErrorUART()) ....
   sercom->clearStatusUART();
 }
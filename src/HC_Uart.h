@@ -13,31 +13,121 @@
   #error This library needs at least a C++11 compliant compiler
 #endif
 
+#include "HC_Config.h"
+
 #include "Coroutine.h"
+#include "Event.h"
+#include "SuperFunctor.h"
+#include "DmaController.h"
+#include "Channel.h"
+#include "TimerWheel.h"
+#include "Scheduler.h"
+
+#include <cstddef>
 
 namespace HC
 {
 
+namespace Config
+{
+// As in HC_Config.h, but only for files that use the ring
+#define HC_CONFIG_RX_RING_CHECK(SIZE) HC_CONFIG_RX_RING_CHECK_(SIZE)
+#define HC_CONFIG_RX_RING_CHECK_(SIZE) uart_rx_ring_size_##SIZE
+extern const int HC_CONFIG_RX_RING_CHECK(HC_UART_RX_RING_SIZE);
+static const int * const uart_rx_ring_size_check __attribute__((used)) = &HC_CONFIG_RX_RING_CHECK(HC_UART_RX_RING_SIZE);
+} // namespace
+
 /**
  * @brief Coroutine Uart class.
  * 
  * A variation of the `::Uart` class customised for use in coroutines.
  * 
- * Buffering is bypassed. Read and write operations block the caller 
- * until a character is available (calling `yield()` while they wait). 
+ * Buffering is bypassed, except by `BUFFERED_RECEIVE`. Read and write 
+ * operations block the caller until a character is available (calling 
+ * `yield()` while they wait). 
  * UART receive errors can be detected and returned. The constructor
  * can be given a pointer to a RAM interrupt vector.
+ * 
+ * There is a choice of receive modes:
+ *  - `HOPPED_RECEIVE`: the interrupt vector is pointed at the calling 
+ *    coroutine, which will usually have hopped onto it. `read()` polls
+ *    the SERCOM each time the coroutine is resumed.
+ *    Optionally adaptive; see `set_adaptive()`.
+ *  - `EVENT_RECEIVE`: the interrupt vector is pointed at our own ISR,
+ *    which takes each character and wakes the coroutine. `read()` 
+ *    parks the coroutine meanwhile, so it is only resumed when there's 
+ *    something to read, and it can stay in foreground.
+ *  - `DMA_RECEIVE`: the DMAC moves characters straight into the 
+ *    caller's buffer, and our ISR only sees errors. Set up with 
+ *    `set_dma()`. The coroutine parks as for `EVENT_RECEIVE`.
+ *  - `BUFFERED_RECEIVE`: our ISR puts characters into a lock-free ring
+ *    buffer, and only wakes the coroutine when the ring reaches a
+ *    watermark (or has all a `read()` needs), when there's an error, 
+ *    or for `read_available()`, when the line goes idle. The coroutine
+ *    then takes everything in the ring at once. It parks as for 
+ *    `EVENT_RECEIVE`.
+ * 
+ * Reading a block with `read( buffer, size, error_p )` resumes the 
+ * coroutine once per character in `HOPPED_RECEIVE`, but in the other
+ * modes only once, when the block is complete or there's an error, or 
+ * in `BUFFERED_RECEIVE` once per watermark. In `DMA_RECEIVE`, errors 
+ * are only reported during a block read; any at other times are 
+ * discarded. In `BUFFERED_RECEIVE`, characters after an error are 
+ * dropped until the error has been reported.
+ * 
+ * Writing with `write()`, which `print()` and the like use, parks or 
+ * yields the calling coroutine rather than busy waiting. Single 
+ * characters go the same way as blocks, so everything goes out in the
+ * order it was written; `::Uart`'s transmit buffer is not used.
+ *  - In `HOPPED_RECEIVE`, the coroutine on the interrupt vector is 
+ *    resumed by the data register empty interrupt for each character,
+ *    while it's still in the hop that called `begin()`. Otherwise, and
+ *    for any other coroutine, it polls, yielding between characters.
+ *  - Otherwise, if `set_tx_dma()` was called, the DMAC sends from the 
+ *    caller's buffer, without copying it. The coroutine parks until 
+ *    it's done. A DMA bus error ends the block early.
+ *  - Otherwise, our ISR sends from the caller's buffer, and the 
+ *    coroutine parks until it's done.
+ * 
+ * The ISR or DMAC sends one block at a time, and other writers wait 
+ * for it to finish. `write()` returns when the last character has been
+ * handed to the SERCOM, not when it has finished going out; use 
+ * `flush()` for that. Outside a coroutine, writes busy wait. `end()` 
+ * wakes any coroutine parked in a read or write, which then returns 
+ * what it got done. One coroutine may write while another reads.
  */
 class Uart : public ::Uart
 {
 public:  
+  /**
+   * @brief Statistics for adaptive `HOPPED_RECEIVE`.
+   */
+  struct AdaptiveStats
+  {
+    uint32_t to_polling_count;   ///< switches from interrupt to polling
+    uint32_t to_interrupt_count; ///< switches from polling to interrupt
+  };
+
   /**
    * UART error codes bitfield
    */
   enum Error
   {
       NO_ERROR = 0x0000,
-      FRAME_ERROR = 0x0001
+      FRAME_ERROR = 0x0001,
+      OVERRUN_ERROR = 0x0002,
+      DMA_ERROR = 0x0004
+  };
+
+  /**
+   * Receive modes; see class description. 
+   */
+  enum ReceiveMode
+  {
+      HOPPED_RECEIVE,
+      EVENT_RECEIVE,
+      DMA_RECEIVE,
+      BUFFERED_RECEIVE
   };
 
   /**
@@ -78,6 +168,85 @@ public:
    */ 
   void end();  
 
+  /**
+   * Choose the receive mode. Takes effect at the next `begin()`. 
+   * 
+   * @param mode the new receive mode. 
+   */ 
+  void set_receive_mode( ReceiveMode mode );
+
+  /**
+   * Give the resources needed for `DMA_RECEIVE`. Takes effect at the 
+   * next `begin()`. 
+   * 
+   * @param dma_controller_ the DMA controller, which must have been begun.
+   * @param rx_channel_ a DMA channel for our use only.
+   * @param hw_ the SERCOM's registers, eg `SERCOM0`.
+   * @param rx_trigger_ the SERCOM's receive trigger, eg `SERCOM0_DMAC_ID_RX`.
+   */ 
+  void set_dma( DmaController *dma_controller_, int rx_channel_, Sercom *hw_, uint8_t rx_trigger_ );
+
+  /**
+   * Make `HOPPED_RECEIVE` adapt to the incoming rate, like Linux NAPI. 
+   * While characters arrive close together, the coroutine stops taking
+   * an interrupt for each one: the SERCOM interrupt is disabled and the
+   * coroutine is attached to the scheduler, which runs it to poll the 
+   * SERCOM. When the line goes quiet, the interrupt is re-enabled and 
+   * the coroutine detached again, for low latency. The changes are 
+   * made by hops, so they take effect when the coroutine next yields.
+   * 
+   * The coroutine must be registered with the scheduler, and must read
+   * from within the hop that called `begin()`, because the switches use
+   * its hop slot. While polling, the scheduler must come round within 
+   * two character times, or characters will be lost.
+   * 
+   * @param scheduler_ the scheduler to poll from, or `nullptr` to stop 
+   * adapting.
+   * @param irqn_ the SERCOM's interrupt, eg `SERCOM0_IRQn`.
+   * @param busy_gap_us_ characters this close together, in microseconds, are busy.
+   * @param busy_count_ number of busy characters in a row to switch to polling.
+   * @param idle_us_ time with no characters, in microseconds, to switch back to interrupts.
+   */ 
+  void set_adaptive( Scheduler *scheduler_, IRQn_Type irqn_, uint32_t busy_gap_us_ = 100, 
+                     int busy_count_ = 8, uint32_t idle_us_ = 1000 );
+
+  /**
+   * Get the adaptive statistics gathered so far.
+   */
+  inline const AdaptiveStats &get_adaptive_stats() const;
+
+  /**
+   * Set the adaptive statistics back to zero.
+   */
+  void reset_adaptive_stats();
+
+  /**
+   * Set how full the ring buffer must get before `BUFFERED_RECEIVE`
+   * wakes a reader that needs more than that. 
+   * 
+   * @param watermark number of characters; the default is half the ring.
+   */ 
+  void set_rx_watermark( int watermark );
+
+  /**
+   * Set how long the line must be idle before `read_available()` 
+   * returns with what it has. 
+   * 
+   * @param ms time in `millis()` units; 0, the default, means don't 
+   * wait: return with whatever the first wakeup brings.
+   */ 
+  void set_rx_idle_time( uint32_t ms );
+
+  /**
+   * Give the resources needed to transmit by DMA. Takes effect straight
+   * away, except in `HOPPED_RECEIVE`, where it's not used. 
+   * 
+   * @param dma_controller_ the DMA controller, which must have been begun.
+   * @param tx_channel_ a DMA channel for our use only.
+   * @param hw_ the SERCOM's registers, eg `SERCOM0`.
+   * @param tx_trigger_ the SERCOM's transmit trigger, eg `SERCOM0_DMAC_ID_TX`.
+   */ 
+  void set_tx_dma( DmaController *dma_controller_, int tx_channel_, Sercom *hw_, uint8_t tx_trigger_ );
 
   /**
    * Similar to `::Uart::read()`, with one extra parameter. 
@@ -88,12 +257,162 @@ public:
    */ 
   int read( Error *error_p = nullptr );
   
+  /**
+   * Blocks while reading a block of characters from the serial port.
+   * Stops early at an error.
+   * 
+   * @param buffer where to put the characters.
+   * @param size number of characters to read.
+   * @param error_p if non-`NULL` the location pointed to is updated with an error code.
+   * @return the number of good characters read, which is the index 
+   * of the error if there was one.
+   */ 
+  size_t read( uint8_t *buffer, size_t size, Error *error_p = nullptr );
+
+  /**
+   * Blocks until there's something to read, then reads what's there,
+   * up to the given size. In `BUFFERED_RECEIVE` with an idle time set,
+   * once there's something, waits for the watermark, for the line to 
+   * go idle or for an error before returning, so that bursts come back
+   * in one piece; see `set_rx_idle_time()`. In other modes, the same 
+   * as `read( buffer, size, error_p )`.
+   * 
+   * @param buffer where to put the characters.
+   * @param size most characters to read.
+   * @param error_p if non-`NULL` the location pointed to is updated with an error code.
+   * @return the number of good characters read, which is the index 
+   * of the error if there was one.
+   */ 
+  size_t read_available( uint8_t *buffer, size_t size, Error *error_p = nullptr );
+  
+  /**
+   * Blocks while writing a block of characters to the serial port.
+   * 
+   * @param buffer the characters, which must stay in place until we return.
+   * @param size number of characters to write.
+   * @return the number of characters written, which is short if the 
+   * port was ended or there was a DMA bus error.
+   */ 
+  size_t write( const uint8_t *buffer, size_t size );
+  
+  /**
+   * Blocks while writing a character to the serial port. Goes the same
+   * way as `write( buffer, size )`.
+   * 
+   * @param data the character.
+   * @return 1, or 0 if the port was ended first.
+   */ 
+  size_t write( uint8_t data );
+  using ::Uart::write;
+  
 private:
+  class Isr : public SuperFunctor
+  {
+  public:
+    explicit Isr( Uart *uart_ );
+  protected:
+    void operator()();
+  private:
+    Uart * const uart;
+  };
+  
+  class DmaClient : public DmaController::Client
+  {
+  public:
+    explicit DmaClient( Uart *uart_ );
+    void handle_dma_done( int channel, bool error );
+  private:
+    Uart * const uart;
+  };
+  
+  void attach_vector();
+  void configure_receive();
+  void end_receive();
+  void handle_interrupt();
+  void handle_interrupt_dma();
+  void handle_interrupt_buffered();
+  void handle_transmit();
   void handle_UART_error( Error *error );
+  void end_block( Error error );
+  size_t read_block_hopped( uint8_t *buffer, size_t size, Error *error_p );
+  void wait_for_receive();
+  void wait_for_receive_adaptive();
+  void request_adaptive_hop( const Task::HopLambda *hop );
+  void hop_to_polling();
+  void hop_to_interrupt();
+  size_t read_block_parked( uint8_t *buffer, size_t size, Error *error_p );
+  size_t read_block_buffered( uint8_t *buffer, size_t size, Error *error_p, bool available );
+  bool is_on_vector() const;
+  bool try_write_direct( uint8_t data );
+  bool claim_transmit();
+  size_t write_block_polled( const uint8_t *buffer, size_t size );
+  size_t write_block_hopped( const uint8_t *buffer, size_t size );
+  size_t write_block_parked( const uint8_t *buffer, size_t size );
   SERCOM *sercom;
   void (**vector_p)();
+  Coroutine *vector_coroutine;
+  Hopper *vector_hopper;
+  ReceiveMode receive_mode;
+  Isr isr;
+  DmaClient dma_client;
+  DmaController *dma_controller;
+  int rx_channel;
+  Sercom *hw;
+  uint8_t rx_trigger;
+  Flag rx_flag;
+  volatile bool rx_enabled;
+  volatile uint8_t rx_data;
+  volatile Error rx_error;
+  
+  // Block being received by the ISR or DMA, if any
+  uint8_t * volatile rx_block;
+  size_t rx_block_size;
+  volatile size_t rx_block_count;
+  
+  // For BUFFERED_RECEIVE. The idle timer's flag is also how the ISR
+  // wakes the reader, so that either can.
+  Channel<uint8_t, HC_UART_RX_RING_SIZE> rx_ring;
+  TimerWheel::Timer rx_idle_timer;
+  volatile int rx_threshold;
+  int rx_watermark;
+  uint32_t rx_idle_ms;
+  volatile uint32_t rx_last_tick;
+  volatile bool rx_idle_wanted;
+  
+  // For adaptive HOPPED_RECEIVE
+  Scheduler *adaptive_scheduler;
+  IRQn_Type adaptive_irqn;
+  uint32_t busy_gap_us;
+  int busy_count;
+  uint32_t idle_us;
+  bool polling;
+  int busy_run;
+  uint32_t last_receive_us;
+  Task *polling_task;
+  Task::HopLambda to_polling_hop;
+  Task::HopLambda to_interrupt_hop;
+  AdaptiveStats adaptive_stats;
+  
+  int tx_channel;
+  uint8_t tx_trigger;
+  Flag tx_flag;
+  volatile bool tx_enabled;
+  volatile bool tx_busy;
+  volatile bool tx_dma_error;
+  
+  // Block being sent by the ISR, if any
+  const uint8_t * volatile tx_block;
+  size_t tx_block_size;
+  volatile size_t tx_block_count;
 };
 
+// Implement the inline functions here
+
+const Uart::AdaptiveStats &Uart::get_adaptive_stats() const
+{
+  return adaptive_stats;
+}
+
 } // namespace
 
 #endif
@@ -0,0 +1,91 @@
+/**
+ * @file HopStats.cpp
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ */
+
+#include "HopStats.h"
+
+#include "Coroutine_arm.h"
+
+#include <cstdint>
+
+using namespace std;
+using namespace HC;
+using namespace Arm;
+
+// Tells the linker which way we were built; see HC_Config.h
+#ifdef HC_HOP_STATS
+const int HC::Config::hop_stats_on = 1;
+#else
+const int HC::Config::hop_stats_off = 1;
+#endif
+
+CycleHistogram::CycleHistogram()
+{
+  reset();
+}
+
+
+void CycleHistogram::record( uint32_t cycles )
+{
+  if( count == 0 || cycles < min )
+    min = cycles;
+  if( count == 0 || cycles > max )
+    max = cycles;
+  count++;
+
+  int bucket = 0;
+  if( cycles >> first_bucket_bits )
+    bucket = (31 - __builtin_clz( cycles )) - first_bucket_bits + 1;
+  if( bucket >= num_buckets )
+    bucket = num_buckets - 1;
+  buckets[bucket]++;
+}
+
+
+void CycleHistogram::reset()
+{
+  count = 0;
+  min = 0;
+  max = 0;
+  for( int i=0; i<num_buckets; i++ )
+    buckets[i] = 0;
+}
+
+
+uint32_t CycleHistogram::get_bucket_floor( int bucket )
+{
+  if( bucket == 0 )
+    return 0;
+  return 1U << (bucket + first_bucket_bits - 1);
+}
+
+
+#ifdef HC_HOP_STATS
+IsrEntryStamp::IsrEntryStamp() :
+  previous_entry_cycles( entry_cycles ),
+  previous_active( active )
+{
+  entry_cycles = get_cycle_count();
+  active = true;
+}
+
+
+IsrEntryStamp::~IsrEntryStamp()
+{
+  entry_cycles = previous_entry_cycles;
+  active = previous_active;
+}
+
+
+volatile uint32_t IsrEntryStamp::entry_cycles = 0;
+volatile bool IsrEntryStamp::active = false;
+
+
+void __attribute__ ((constructor)) init_hop_stats()
+{
+  enable_cycle_count();
+}
+#endif
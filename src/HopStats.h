@@ -0,0 +1,162 @@
+/**
+ * @file HopStats.h
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ *
+ * @brief Interrupt latency and residency measurement for tasks
+ */
+#ifndef HopStats_h
+#define HopStats_h
+
+#if __cplusplus <= 199711L
+  #error This library needs at least a C++11 compliant compiler
+#endif
+
+#include "HC_Config.h"
+
+#include <cstdint>
+
+namespace HC
+{
+
+/**
+ * @brief Distribution of a time interval, in CPU cycles.
+ *
+ * Keeps the count, min and max, and a histogram with power-of-2
+ * buckets. Bucket 0 is everything below 128 cycles; each bucket after
+ * that is twice as wide as the last, and the last has no upper limit.
+ * Reading while another context records gives a snapshot that may be
+ * slightly inconsistent.
+ */
+class CycleHistogram
+{
+public:
+  static const int num_buckets = 12;
+
+  CycleHistogram();
+
+  /**
+   * Add one interval to the distribution.
+   *
+   * @param cycles the interval in CPU cycles.
+   */
+  void record( uint32_t cycles );
+
+  /**
+   * Forget everything recorded so far.
+   */
+  void reset();
+
+  inline uint32_t get_count() const;
+  inline uint32_t get_min() const;
+  inline uint32_t get_max() const;
+  inline uint32_t get_bucket( int bucket ) const;
+
+  /**
+   * Get the lowest number of cycles counted in a bucket.
+   */
+  static uint32_t get_bucket_floor( int bucket );
+
+private:
+  static const int first_bucket_bits = 7;
+
+  volatile uint32_t count;
+  volatile uint32_t min;
+  volatile uint32_t max;
+  volatile uint32_t buckets[num_buckets];
+};
+
+
+/**
+ * @brief Hop statistics for one task.
+ */
+struct HopStats
+{
+  /// From entry to an `HC_INTERRUPT_HANDLER` to the coroutine resuming
+  CycleHistogram latency;
+
+  /// From the coroutine resuming in any interrupt to it yielding
+  CycleHistogram residency;
+};
+
+
+#ifdef HC_HOP_STATS
+/**
+ * @brief Records the time of entry to an interrupt handler.
+ *
+ * Placed at the top of handlers generated by `HC_INTERRUPT_HANDLER`.
+ * Nested interrupts each get their own entry time, and the outer one
+ * is restored on exit.
+ */
+class IsrEntryStamp
+{
+public:
+  IsrEntryStamp();
+  ~IsrEntryStamp();
+
+  /**
+   * Find out whether we're in a stamped handler.
+   */
+  inline static bool is_active();
+
+  /**
+   * Get the cycle count at entry to the innermost stamped handler.
+   */
+  inline static uint32_t get_entry_cycles();
+
+private:
+  const uint32_t previous_entry_cycles;
+  const bool previous_active;
+
+  static volatile uint32_t entry_cycles;
+  static volatile bool active;
+};
+
+#define HC_HOP_STATS_ISR_ENTRY() HC::IsrEntryStamp hc_isr_entry_stamp
+#else
+#define HC_HOP_STATS_ISR_ENTRY()
+#endif
+
+// Implement the inline functions here
+
+uint32_t CycleHistogram::get_count() const
+{
+  return count;
+}
+
+
+uint32_t CycleHistogram::get_min() const
+{
+  return min;
+}
+
+
+uint32_t CycleHistogram::get_max() const
+{
+  return max;
+}
+
+
+uint32_t CycleHistogram::get_bucket( int bucket ) const
+{
+  return buckets[bucket];
+}
+
+
+#ifdef HC_HOP_STATS
+bool IsrEntryStamp::is_active()
+{
+  return active;
+}
+
+
+uint32_t IsrEntryStamp::get_entry_cycles()
+{
+  return entry_cycles;
+}
+#endif
+
+} // namespace
+
+#endif
@@ -7,41 +7,40 @@
 
 #include "Hopper.h"
 
-#include <functional>
-#include <atomic>
-
 using namespace std;
 using namespace HC;
 
-Hopper::Hopper( std::function<void()> &&attach_, std::function<void()> &&detach_ ) :
-  previous_hop( current_hop ),
-  attach( move(attach_) ),
-  detach( move(detach_) )
+void Hopper::enter()
 {
+  HC_ASSERT( coroutine, "Hopper created outside a coroutine" );
+  previous_hop = coroutine->current_hopper;
   if( previous_hop )
     previous_hop->detach();
-  me()->set_hop_lambda( attach );
-  current_hop = this;
-}
-
-
-void Hopper::hop(std::function<void()> &&new_attach, std::function<void()> &&new_detach)
-{
-  detach();
-  attach = move(new_attach);
-  detach = move(new_detach);
-  me()->set_hop_lambda( attach );
+  request_attach();
+  coroutine->current_hopper = this;
 }
 
 
 Hopper::~Hopper()
 {
-  current_hop = previous_hop;
+  coroutine->current_hopper = previous_hop;
   detach();
   if( previous_hop )
-    me()->set_hop_lambda( previous_hop->attach );
+  {
+    previous_hop->request_attach();
+  }
+  else
+  {
+    // Our attach lambda must not run after we're gone
+    coroutine->set_hop( nullptr );
+  }
 }
 
 
-__thread Hopper *Hopper::current_hop;
-
+void Hopper::request_attach()
+{
+  // The task only keeps a pointer to our attach lambda until it runs 
+  // it, from a copy. That's OK because we always replace or cancel the
+  // request before we're destructed.
+  coroutine->set_hop( &attach );
+}
@@ -13,11 +13,11 @@
   #error This library needs at least a C++11 compliant compiler
 #endif
 
+#include "HC_Config.h"
+
 #include "Tracing.h"
 #include "Coroutine.h"
 
-#include <functional>
-
 namespace HC
 {
 /**
@@ -43,6 +43,11 @@ namespace HC
  * the majority of the processing work, but to occasionally hop onto 
  * a device interrupt to perfom time-critical I/O. When the function
  * returns, the default context is re-attached automatically.
+ * 
+ * The lambdas are constructed directly inside the `Hopper` object, and
+ * the chain of nested `Hopper` objects is kept in the coroutine, so 
+ * creating and destroying one never allocates and is cheap enough to 
+ * do per frame or per edge.
  */ 
 class Hopper
 {
@@ -56,7 +61,8 @@ public:
    * @param attach_ a lambda that is executed when hopping on to the context
    * @param detach_ a lambda that is executed when hopping off the context
    */ 
-  Hopper( std::function<void()> &&attach_, std::function<void()> &&detach_ );
+  template<typename ATTACH, typename DETACH>
+  inline Hopper( ATTACH &&attach_, DETACH &&detach_ );
   
   /**
    * Hopper destructor. Will detach from this `Hopper` object's context, 
@@ -64,7 +70,7 @@ public:
    * context, if one existed. **Note that the attach_ lambda is not 
    * actually executed until the next yield operation.**
    */
-~Hopper();
+  ~Hopper();
   
   /**
    * Perform a sideways hop. Change the current hop without needing to 
@@ -75,16 +81,45 @@ public:
    * @param new_attach a lambda that is executed when hopping on to the context
    * @param new_detach a lambda that is executed when hopping off the context
    */ 
-  void hop(std::function<void()> &&new_attach, std::function<void()> &&new_detach);
+  template<typename ATTACH, typename DETACH>
+  inline void hop( ATTACH &&new_attach, DETACH &&new_detach );
+
+  Hopper( const Hopper & ) = delete;
+  Hopper &operator=( const Hopper & ) = delete;
 
 private: 
-  Hopper * const previous_hop;
-  static __thread Hopper *current_hop;
+  void enter();
+  void request_attach();
+  
+  Coroutine * const coroutine;
+  Hopper *previous_hop;
 
-  std::function<void()> detach;                             
-  std::function<void()> attach;
+  Task::HopLambda attach;
+  Task::HopLambda detach;                             
 };
 
+// Implement the inline functions here
+
+template<typename ATTACH, typename DETACH>
+Hopper::Hopper( ATTACH &&attach_, DETACH &&detach_ ) :
+  coroutine( me() ),
+  previous_hop( nullptr ),
+  attach( std::forward<ATTACH>(attach_) ),
+  detach( std::forward<DETACH>(detach_) )
+{
+  enter();
+}
+
+
+template<typename ATTACH, typename DETACH>
+void Hopper::hop( ATTACH &&new_attach, DETACH &&new_detach )
+{
+  detach();
+  attach = std::forward<ATTACH>(new_attach);
+  detach = std::forward<DETACH>(new_detach);
+  request_attach();
+}
+
 } // namespace
 
 #endif
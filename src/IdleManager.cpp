@@ -0,0 +1,147 @@
+/**
+ * @file IdleManager.cpp
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ */
+
+#include "IdleManager.h"
+
+#include "Coroutine_arm.h"
+
+#include <cstdint>
+
+#include "Arduino.h"
+#include "sam.h"
+
+using namespace std;
+using namespace HC;
+using namespace Arm;
+
+// The core's SysTick work: counts one millisecond
+extern "C" void SysTick_DefaultHandler(void);
+
+// Too close to a tick boundary to safely re-program SysTick
+static const uint32_t min_reload_cycles = 64;
+
+
+IdleManager::IdleManager( Scheduler &scheduler_ ) :
+  scheduler( scheduler_ ),
+  idle_cycles_remainder( 0 )
+{
+  reset_stats();
+}
+
+
+void IdleManager::idle()
+{
+  // With PRIMASK set, WFI still wakes on an interrupt, but the ISR only
+  // runs after we've put things back.
+  RAII_PRIMASK lock;
+  if( scheduler.has_ready() )
+    return;
+
+  const uint32_t cycles_per_tick = SysTick->LOAD + 1;
+  const uint32_t max_ticks = (SysTick_LOAD_RELOAD_Msk + 1) / cycles_per_tick - 1;
+  const uint32_t ticks = get_system_timer_wheel().get_ticks_to_next_work( max_ticks );
+
+  uint32_t cycles;
+  if( ticks < 2 )
+    cycles = sleep( cycles_per_tick );
+  else
+    cycles = sleep_tickless( ticks, cycles_per_tick );
+  stats.sleep_count++;
+  record_idle_cycles( cycles, cycles_per_tick );
+}
+
+
+void IdleManager::reset_stats()
+{
+  stats.sleep_count = 0;
+  stats.tickless_count = 0;
+  stats.ticks_skipped = 0;
+  stats.idle_ms = 0;
+  idle_cycles_remainder = 0;
+}
+
+
+uint32_t IdleManager::sleep( uint32_t cycles_per_tick )
+{
+  // Sleep until the next interrupt, which is at most one tick away
+  (void)SysTick->CTRL; // clears COUNTFLAG
+  const uint32_t start = SysTick->VAL;
+  __DSB();
+  __WFI();
+  const uint32_t end = SysTick->VAL;
+  if( SysTick->CTRL & SysTick_CTRL_COUNTFLAG_Msk )
+    return start + (cycles_per_tick - end);
+  else
+    return start - end;
+}
+
+
+uint32_t IdleManager::sleep_tickless( uint32_t ticks, uint32_t cycles_per_tick )
+{
+  // Stop the tick and see how long is left of the current one
+  SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
+  const uint32_t remaining = SysTick->VAL;
+  if( remaining < min_reload_cycles || (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) )
+  {
+    SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+    return sleep( cycles_per_tick );
+  }
+  stats.tickless_count++;
+
+  // Stretch the tick so that it next goes off when the wheel has work
+  const uint32_t period = remaining + (ticks-1) * cycles_per_tick;
+  SysTick->LOAD = period - 1;
+  SysTick->VAL = 0;
+  SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+
+  __DSB();
+  __WFI();
+
+  // Work out how long we slept and how many tick boundaries we crossed.
+  // If the stretched tick went off, it will have reloaded and kept going.
+  SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
+  const uint32_t counted = (period - 1) - SysTick->VAL;
+  uint32_t elapsed = counted;
+  if( SCB->ICSR & SCB_ICSR_PENDSTSET_Msk )
+  {
+    elapsed += period;
+    SCB->ICSR = SCB_ICSR_PENDSTCLR_Msk; // we'll count it ourselves
+  }
+  uint32_t ticks_passed = 0;
+  if( elapsed >= remaining )
+    ticks_passed = 1 + (elapsed - remaining) / cycles_per_tick;
+  uint32_t to_next_tick = remaining + ticks_passed * cycles_per_tick - elapsed;
+  if( to_next_tick < min_reload_cycles )
+  {
+    ticks_passed++;
+    to_next_tick += cycles_per_tick;
+  }
+
+  // Restart with a short first period to get back in phase, then let
+  // the normal period take over at the reload.
+  SysTick->LOAD = to_next_tick - 1;
+  SysTick->VAL = 0;
+  SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+  SysTick->LOAD = cycles_per_tick - 1;
+
+  // Catch up millis() and the wheel
+  for( uint32_t i=0; i<ticks_passed; i++ )
+    SysTick_DefaultHandler();
+  get_system_timer_wheel().advance( millis() );
+  stats.ticks_skipped += ticks_passed;
+
+  return elapsed;
+}
+
+
+void IdleManager::record_idle_cycles( uint32_t cycles, uint32_t cycles_per_tick )
+{
+  // SysTick is set up to tick every millisecond
+  idle_cycles_remainder += cycles;
+  stats.idle_ms += idle_cycles_remainder / cycles_per_tick;
+  idle_cycles_remainder %= cycles_per_tick;
+}
@@ -0,0 +1,101 @@
+/**
+ * @file IdleManager.h
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ *
+ * @brief Tickless idle for when there's nothing to run
+ */
+#ifndef IdleManager_h
+#define IdleManager_h
+
+#if __cplusplus <= 199711L
+  #error This library needs at least a C++11 compliant compiler
+#endif
+
+#include "HC_Config.h"
+
+#include "Scheduler.h"
+#include "TimerWheel.h"
+
+#include <cstdint>
+
+namespace HC
+{
+
+/**
+ * @brief Puts the CPU to sleep while every task is blocked.
+ *
+ * Call `idle()` from `loop()` when the scheduler has nothing to run, eg
+ *
+ * `if( !scheduler.run_one() )`\n
+ * `  idle_manager.idle();`\n
+ *
+ * If no task is ready, we sleep with `WFI` until an interrupt. Tasks
+ * that are parked, sleeping or hopped onto interrupts can only be made
+ * ready by an interrupt, so nothing is missed. If the system timer
+ * wheel has nothing to do for a while, we also stretch the SysTick
+ * period to reach its next deadline, so we aren't woken every
+ * millisecond. On waking, `millis()` and the wheel are caught up with
+ * the ticks we skipped.
+ *
+ * While stretched, SysTick is only accurate to a few cycles per sleep,
+ * and `micros()` is not valid, but both are only observed once we have
+ * put things back.
+ */
+class IdleManager
+{
+public:
+  /**
+   * @brief Idle-time statistics.
+   */
+  struct Stats
+  {
+    uint32_t sleep_count;    ///< number of times we slept
+    uint32_t tickless_count; ///< of which, number with SysTick stretched
+    uint32_t ticks_skipped;  ///< ticks caught up after stretching, not interrupted for
+    uint32_t idle_ms;        ///< total time asleep, in milliseconds
+  };
+
+  /**
+   * Create an instance.
+   *
+   * @param scheduler_ the scheduler whose tasks we wait for.
+   */
+  explicit IdleManager( Scheduler &scheduler_ );
+
+  /**
+   * Sleep until an interrupt, if no task is ready.
+   */
+  void idle();
+
+  /**
+   * Get the statistics gathered so far.
+   */
+  inline const Stats &get_stats() const;
+
+  /**
+   * Set the statistics back to zero.
+   */
+  void reset_stats();
+
+private:
+  uint32_t sleep( uint32_t cycles_per_tick );
+  uint32_t sleep_tickless( uint32_t ticks, uint32_t cycles_per_tick );
+  void record_idle_cycles( uint32_t cycles, uint32_t cycles_per_tick );
+
+  Scheduler &scheduler;
+  Stats stats;
+  uint32_t idle_cycles_remainder;
+};
+
+// Implement the inline functions here
+
+const IdleManager::Stats &IdleManager::get_stats() const
+{
+  return stats;
+}
+
+} // namespace
+
+#endif
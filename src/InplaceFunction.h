@@ -0,0 +1,276 @@
+/**
+ * @file InplaceFunction.h
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ *
+ * @brief Non-allocating alternative to std::function
+ */
+#ifndef InplaceFunction_h
+#define InplaceFunction_h
+
+#if __cplusplus <= 199711L
+  #error This library needs at least a C++11 compliant compiler
+#endif
+
+#include "HC_Config.h"
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace HC
+{
+
+template<typename SIGNATURE, int CAPACITY = 4 * sizeof(void *), bool COPYABLE = false>
+class InplaceFunction;
+
+/**
+ * @brief Function object wrapper that never allocates.
+ *
+ * Like `std::function`, this can hold any callable object with the
+ * right signature. Unlike `std::function`, the callable is always
+ * stored inside the wrapper, so construction, moving and destruction
+ * never touch the heap and are safe in interrupt context. A callable
+ * that is too big (usually a lambda with too many captures) fails to
+ * compile rather than silently allocating.
+ *
+ * By default it is move-only, so the callable is never duplicated. 
+ * If `COPYABLE` is set, it can be copied too, and then only accepts 
+ * callables that can be copied. Calling an empty `InplaceFunction` is
+ * not allowed.
+ *
+ * @tparam R return type of the callable.
+ * @tparam ARGS argument types of the callable.
+ * @tparam CAPACITY space for the callable, in bytes.
+ * @tparam COPYABLE whether instances can be copied.
+ */
+template<typename R, typename ...ARGS, int CAPACITY, bool COPYABLE>
+class InplaceFunction<R(ARGS...), CAPACITY, COPYABLE>
+{
+  // Unless COPYABLE, the copy operations below take this instead, so 
+  // they aren't copy operations, and the class stays move-only
+  struct NotCopyable;
+  typedef typename std::conditional<COPYABLE, const InplaceFunction &, const NotCopyable &>::type CopySource;
+
+public:
+  /**
+   * Create an empty instance.
+   */
+  InplaceFunction() :
+    invoker( nullptr ),
+    manager( nullptr )
+  {
+  }
+
+  /**
+   * Create an empty instance.
+   */
+  InplaceFunction( std::nullptr_t ) :
+    InplaceFunction()
+  {
+  }
+
+  /**
+   * Create an instance holding a callable.
+   *
+   * @param callable the callable object, which is moved or copied in.
+   */
+  template<typename CALLABLE,
+           typename = typename std::enable_if< !std::is_same<typename std::decay<CALLABLE>::type, InplaceFunction>::value >::type>
+  InplaceFunction( CALLABLE &&callable ) :
+    invoker( &invoke<typename std::decay<CALLABLE>::type> ),
+    manager( &manage<typename std::decay<CALLABLE>::type> )
+  {
+    typedef typename std::decay<CALLABLE>::type Callable;
+    static_assert( sizeof(Callable) <= CAPACITY, "callable is too big for this InplaceFunction: reduce captures or increase CAPACITY" );
+    static_assert( alignof(Callable) <= alignof(Storage), "callable is over-aligned for InplaceFunction" );
+    static_assert( !COPYABLE || std::is_copy_constructible<Callable>::value, "callable must be copyable for a COPYABLE InplaceFunction" );
+    new (&storage) Callable( std::forward<CALLABLE>(callable) );
+  }
+
+  /**
+   * Take the callable from another instance, leaving it empty.
+   */
+  InplaceFunction( InplaceFunction &&other ) :
+    invoker( other.invoker ),
+    manager( other.manager )
+  {
+    if( manager )
+      manager( MOVE, &storage, &other.storage );
+    other.invoker = nullptr;
+    other.manager = nullptr;
+  }
+
+  /**
+   * Copy the callable from another instance. Only for `COPYABLE` 
+   * instances.
+   */
+  InplaceFunction( CopySource other ) :
+    invoker( other.invoker ),
+    manager( other.manager )
+  {
+    if( manager )
+      manager( COPY, &storage, const_cast<Storage *>(&other.storage) );
+  }
+
+  /**
+   * Destroy the callable, if any.
+   */
+  ~InplaceFunction()
+  {
+    reset();
+  }
+
+  /**
+   * Take the callable from another instance, leaving it empty.
+   */
+  InplaceFunction &operator=( InplaceFunction &&other )
+  {
+    if( &other != this )
+    {
+      reset();
+      invoker = other.invoker;
+      manager = other.manager;
+      if( manager )
+        manager( MOVE, &storage, &other.storage );
+      other.invoker = nullptr;
+      other.manager = nullptr;
+    }
+    return *this;
+  }
+
+  /**
+   * Copy the callable from another instance. Only for `COPYABLE` 
+   * instances.
+   */
+  InplaceFunction &operator=( CopySource other )
+  {
+    if( &other != this )
+    {
+      reset();
+      invoker = other.invoker;
+      manager = other.manager;
+      if( manager )
+        manager( COPY, &storage, const_cast<Storage *>(&other.storage) );
+    }
+    return *this;
+  }
+
+  /**
+   * Replace the callable, constructing the new one in place.
+   *
+   * @param callable the callable object, which is moved or copied in.
+   */
+  template<typename CALLABLE,
+           typename = typename std::enable_if< !std::is_same<typename std::decay<CALLABLE>::type, InplaceFunction>::value >::type>
+  InplaceFunction &operator=( CALLABLE &&callable )
+  {
+    typedef typename std::decay<CALLABLE>::type Callable;
+    static_assert( sizeof(Callable) <= CAPACITY, "callable is too big for this InplaceFunction: reduce captures or increase CAPACITY" );
+    static_assert( alignof(Callable) <= alignof(Storage), "callable is over-aligned for InplaceFunction" );
+    static_assert( !COPYABLE || std::is_copy_constructible<Callable>::value, "callable must be copyable for a COPYABLE InplaceFunction" );
+    reset();
+    new (&storage) Callable( std::forward<CALLABLE>(callable) );
+    invoker = &invoke<Callable>;
+    manager = &manage<Callable>;
+    return *this;
+  }
+
+  /**
+   * Make the instance empty.
+   */
+  InplaceFunction &operator=( std::nullptr_t )
+  {
+    reset();
+    return *this;
+  }
+
+  /**
+   * Test for non-empty.
+   */
+  explicit operator bool() const
+  {
+    return invoker != nullptr;
+  }
+
+  /**
+   * Invoke the callable. Must not be empty.
+   */
+  R operator()( ARGS ...args ) const
+  {
+    return invoker( &storage, std::forward<ARGS>(args)... );
+  }
+
+private:
+  enum Operation
+  {
+    MOVE,
+    COPY,
+    DESTROY
+  };
+
+  typedef typename std::aligned_storage<CAPACITY, 8>::type Storage;
+  typedef R (*Invoker)( const Storage *storage, ARGS ...args );
+  typedef void (*Manager)( Operation op, Storage *dest, Storage *src );
+
+  template<typename CALLABLE>
+  static R invoke( const Storage *storage, ARGS ...args )
+  {
+    // Like std::function, we allow a non-const callable to be called
+    // via a const wrapper.
+    CALLABLE *callable = const_cast<CALLABLE *>( reinterpret_cast<const CALLABLE *>(storage) );
+    return (*callable)( std::forward<ARGS>(args)... );
+  }
+
+  template<typename CALLABLE>
+  static void manage( Operation op, Storage *dest, Storage *src )
+  {
+    switch( op )
+    {
+      case MOVE: {
+        CALLABLE *src_callable = reinterpret_cast<CALLABLE *>(src);
+        new (dest) CALLABLE( std::move(*src_callable) );
+        src_callable->~CALLABLE();
+        break;
+      }
+      case COPY: {
+        copy<CALLABLE>( dest, src, std::integral_constant<bool, COPYABLE>() );
+        break;
+      }
+      case DESTROY: {
+        reinterpret_cast<CALLABLE *>(dest)->~CALLABLE();
+        break;
+      }
+    }
+  }
+
+  template<typename CALLABLE>
+  static void copy( Storage *dest, const Storage *src, std::true_type )
+  {
+    new (dest) CALLABLE( *reinterpret_cast<const CALLABLE *>(src) );
+  }
+
+  template<typename CALLABLE>
+  static void copy( Storage *dest, const Storage *src, std::false_type )
+  {
+    // Not reached: only COPYABLE instances are copied
+  }
+
+  void reset()
+  {
+    if( manager )
+      manager( DESTROY, &storage, nullptr );
+    invoker = nullptr;
+    manager = nullptr;
+  }
+
+  Invoker invoker;
+  Manager manager;
+  Storage storage;
+};
+
+} // namespace
+
+#endif
@@ -10,6 +10,8 @@
 #ifndef Integration_h
 #define Integration_h
 
+#include "HC_Config.h"
+
 extern void system_idle_tasks();
 
 extern void bring_in_Integration();
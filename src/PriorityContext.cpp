@@ -0,0 +1,53 @@
+/**
+ * @file PriorityContext.cpp
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ */
+
+#include "PriorityContext.h"
+
+#include "Coroutine_arm.h"
+#include "Tracing.h"
+
+#include <cstdint>
+
+using namespace std;
+using namespace HC;
+using namespace Arm;
+
+PriorityContext::PriorityContext( IRQn_Type irqn_, void (**vector_)(), uint32_t priority_ ) :
+  irqn( irqn_ ),
+  vector( vector_ ),
+  task( nullptr )
+{
+  HC_ASSERT( irqn == PendSV_IRQn || irqn >= 0, "IRQ %d cannot be triggered by software", irqn );
+  NVIC_SetPriority( irqn, priority_ );
+}
+
+
+void PriorityContext::attach( Task &task_ )
+{
+  RAII_PRIMASK lock;
+  HC_ASSERT( !task, "priority context %p already has task %p", this, task );
+  HC_ASSERT( !task_.priority_context, "task %p is already in a priority context", &task_ );
+  task = &task_;
+  task_.priority_context = this;
+  *vector = task_;
+  if( irqn != PendSV_IRQn )
+    NVIC_EnableIRQ( irqn );
+  trigger();
+}
+
+
+void PriorityContext::detach( Task &task_ )
+{
+  RAII_PRIMASK lock;
+  HC_ASSERT( task == &task_, "task %p is not attached to priority context %p", &task_, this );
+  if( irqn != PendSV_IRQn )
+    NVIC_DisableIRQ( irqn );
+  clear_pending();
+  *vector = nullptr;
+  task_.priority_context = nullptr;
+  task = nullptr;
+}
@@ -0,0 +1,118 @@
+/**
+ * @file PriorityContext.h
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ *
+ * @brief Software-triggered interrupt levels to hop onto
+ */
+#ifndef PriorityContext_h
+#define PriorityContext_h
+
+#if __cplusplus <= 199711L
+  #error This library needs at least a C++11 compliant compiler
+#endif
+
+#include "HC_Config.h"
+
+#include "Task.h"
+
+#include <cstdint>
+#include "sam.h"
+
+namespace HC
+{
+
+/**
+ * @brief An interrupt level with no peripheral behind it.
+ *
+ * Uses PendSV, or an NVIC line whose peripheral is not in use, as an
+ * execution level that we trigger ourselves by making the interrupt
+ * pending. A coroutine that hops here is resumed as soon as the hop
+ * completes, at the interrupt's priority, pre-empting the foreground
+ * and any lower priority interrupts. This gives urgent work its own
+ * priority band without waiting for a real interrupt.
+ *
+ * The handler must be declared with `HC_INTERRUPT_HANDLER` so that it
+ * can be re-directed, eg
+ *
+ * `HC_INTERRUPT_HANDLER(PendSV_Handler)`\n
+ * `HC::PriorityContext urgent( PendSV_IRQn, get_PendSV_Handler(), 0 );`\n
+ *
+ * and then a coroutine hops on and off with
+ *
+ * `HC::Hopper hopper( []{ urgent.attach(*me()); },`\n
+ * `                   []{ urgent.detach(*me()); } );`\n
+ *
+ * One task at a time may be attached. It is invoked whenever the
+ * interrupt is triggered: on attach, by `trigger()`, and when it is
+ * woken after waiting on an `Event`, `Flag` or `Semaphore`. Yielding
+ * returns from the interrupt, and the task is not invoked again until
+ * the next trigger.
+ *
+ * Everything may be called from interrupt context.
+ */
+class PriorityContext
+{
+public:
+  /**
+   * Create an instance, and set the interrupt's priority.
+   *
+   * @param irqn_ the interrupt: `PendSV_IRQn` or an unused NVIC line.
+   * @param vector_ the handler's re-direction pointer, from the 
+   * `get_` function generated by `HC_INTERRUPT_HANDLER`.
+   * @param priority_ the NVIC priority; lower numbers pre-empt higher.
+   */
+  PriorityContext( IRQn_Type irqn_, void (**vector_)(), uint32_t priority_ );
+
+  /**
+   * Attach a task, and trigger it so that it runs straight away.
+   *
+   * @param task the task.
+   */
+  void attach( Task &task );
+
+  /**
+   * Detach the attached task. Any trigger it hasn't yet run for is
+   * cancelled.
+   *
+   * @param task the task, which must be attached.
+   */
+  void detach( Task &task );
+
+  /**
+   * Make the interrupt pending, so that the attached task is invoked
+   * as soon as the priority allows.
+   */
+  inline void trigger();
+
+private:
+  inline void clear_pending();
+
+  const IRQn_Type irqn;
+  void (** const vector)();
+  Task *task;
+};
+
+// Implement the inline functions here
+
+void PriorityContext::trigger()
+{
+  if( irqn == PendSV_IRQn )
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+  else
+    NVIC_SetPendingIRQ( irqn );
+}
+
+
+void PriorityContext::clear_pending()
+{
+  if( irqn == PendSV_IRQn )
+    SCB->ICSR = SCB_ICSR_PENDSVCLR_Msk;
+  else
+    NVIC_ClearPendingIRQ( irqn );
+}
+
+} // namespace
+
+#endif
@@ -0,0 +1,160 @@
+/**
+ * @file Scheduler.cpp
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ */
+
+#include "Scheduler.h"
+
+#include "Coroutine_arm.h"
+#include "Tracing.h"
+
+#include <cstdint>
+
+using namespace std;
+using namespace HC;
+using namespace Arm;
+
+Scheduler::Scheduler() :
+  ready_mask( 0 )
+{
+  for( int i=0; i<num_priorities; i++ )
+  {
+    ready_head[i] = nullptr;
+    ready_tail[i] = nullptr;
+  }
+}
+
+
+void Scheduler::add( Task &task, int priority )
+{
+  HC_ASSERT( !task.scheduler, "task %p is already registered with a scheduler", &task );
+  HC_ASSERT( priority >= 0 && priority < num_priorities, "bad priority %d", priority );
+
+  RAII_PRIMASK lock;
+  task.scheduler = this;
+  task.priority = priority;
+  task.attached = true;
+  task.queued = false;
+  if( !task.is_blocked() )
+    enqueue( task );
+}
+
+
+void Scheduler::remove( Task &task )
+{
+  HC_ASSERT( task.scheduler == this, "task %p is not registered with scheduler %p", &task, this );
+
+  RAII_PRIMASK lock;
+  if( task.queued )
+    dequeue( task );
+  task.scheduler = nullptr;
+}
+
+
+void Scheduler::attach( Task &task )
+{
+  HC_ASSERT( task.scheduler == this, "task %p is not registered with scheduler %p", &task, this );
+
+  RAII_PRIMASK lock;
+  task.attached = true;
+  if( !task.queued && !task.is_blocked() )
+    enqueue( task );
+}
+
+
+void Scheduler::detach( Task &task )
+{
+  HC_ASSERT( task.scheduler == this, "task %p is not registered with scheduler %p", &task, this );
+
+  RAII_PRIMASK lock;
+  task.attached = false;
+  if( task.queued )
+    dequeue( task );
+}
+
+
+void Scheduler::wake( Task &task )
+{
+  RAII_PRIMASK lock;
+  if( task.attached && !task.queued && !task.is_blocked() )
+    enqueue( task );
+}
+
+
+bool Scheduler::run_one()
+{
+  Task *task;
+  {
+    RAII_PRIMASK lock;
+    task = pop_highest();
+  }
+  if( !task )
+    return false;
+
+  (*task)();
+
+  // Go to the back of the queue if we're still ready. We might already
+  // be queued if we were woken or re-attached while running.
+  RAII_PRIMASK lock;
+  if( task->scheduler == this && task->attached && !task->queued && !task->is_blocked() )
+    enqueue( *task );
+  return true;
+}
+
+
+void Scheduler::enqueue( Task &task )
+{
+  const int p = task.priority;
+  task.next_ready = nullptr;
+  if( ready_tail[p] )
+    ready_tail[p]->next_ready = &task;
+  else
+    ready_head[p] = &task;
+  ready_tail[p] = &task;
+  ready_mask |= 1U << p;
+  task.queued = true;
+}
+
+
+void Scheduler::dequeue( Task &task )
+{
+  // Only used for detach and remove, so a linear search is OK
+  const int p = task.priority;
+  Task *prev = nullptr;
+  for( Task *t = ready_head[p]; t; prev = t, t = t->next_ready )
+  {
+    if( t != &task )
+      continue;
+    if( prev )
+      prev->next_ready = t->next_ready;
+    else
+      ready_head[p] = t->next_ready;
+    if( ready_tail[p] == t )
+      ready_tail[p] = prev;
+    break;
+  }
+  if( !ready_head[p] )
+    ready_mask &= ~(1U << p);
+  task.next_ready = nullptr;
+  task.queued = false;
+}
+
+
+Task *Scheduler::pop_highest()
+{
+  if( !ready_mask )
+    return nullptr;
+  const int p = 31 - __builtin_clz( ready_mask );
+  Task * const task = ready_head[p];
+  ready_head[p] = task->next_ready;
+  if( !ready_head[p] )
+  {
+    ready_tail[p] = nullptr;
+    ready_mask &= ~(1U << p);
+  }
+  task->next_ready = nullptr;
+  task->queued = false;
+  return task;
+}
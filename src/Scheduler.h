@@ -0,0 +1,131 @@
+/**
+ * @file Scheduler.h
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ *
+ * @brief Priority run-queue scheduler for tasks
+ */
+#ifndef Scheduler_h
+#define Scheduler_h
+
+#if __cplusplus <= 199711L
+  #error This library needs at least a C++11 compliant compiler
+#endif
+
+#include "HC_Config.h"
+
+#include "Task.h"
+
+#include <cstdint>
+
+namespace HC
+{
+
+/**
+ * @brief Invokes the foreground tasks that are ready to run.
+ *
+ * Tasks are registered with a priority. `run_one()` invokes the first
+ * ready task at the highest priority that has one, and tasks at the
+ * same priority take turns. Each priority has its own queue of ready
+ * tasks and there's a bitmap of non-empty queues, so finding the next
+ * task is O(1) however many tasks there are.
+ *
+ * A task is ready when it is _attached_ to the scheduler and not
+ * blocked (see `Task::is_blocked()`). A coroutine is blocked while it
+ * is parked on an `Event`, `Flag` or `Semaphore`, and is made ready
+ * again when it's woken, so a blocked coroutine is never invoked.
+ *
+ * A task that hops onto an interrupt should detach from the scheduler
+ * while it's there, and re-attach when it hops back to foreground. Use
+ * eg
+ *
+ * `HC::Hopper fg( []{ scheduler.attach(*me()); },`\n
+ * `               []{ scheduler.detach(*me()); } );`\n
+ *
+ * at the top of the coroutine, so that it is only run by the scheduler
+ * while it has no other hop in effect.
+ *
+ * Everything except `run_one()` may be called from interrupt context.
+ */
+class Scheduler
+{
+public:
+  /**
+   * Number of priority levels. Priorities run from 0 (lowest) up to
+   * one less than this.
+   */
+  static const int num_priorities = 8;
+
+  Scheduler();
+
+  /**
+   * Register a task. It starts out attached.
+   *
+   * @param task the task, which must not already be registered.
+   * @param priority its priority.
+   */
+  void add( Task &task, int priority = 0 );
+
+  /**
+   * Unregister a task.
+   *
+   * @param task the task, which must be registered with us.
+   */
+  void remove( Task &task );
+
+  /**
+   * Start invoking a task again, if it is ready.
+   *
+   * @param task the task, which must be registered with us.
+   */
+  void attach( Task &task );
+
+  /**
+   * Stop invoking a task; use when it is hopping onto an interrupt.
+   *
+   * @param task the task, which must be registered with us.
+   */
+  void detach( Task &task );
+
+  /**
+   * Make a task ready if it's attached and not blocked. Usually called
+   * via `Task::wake()`.
+   *
+   * @param task the task, which must be registered with us.
+   */
+  void wake( Task &task );
+
+  /**
+   * Invoke the next ready task, if there is one. Call this from `loop()`.
+   *
+   * @return true if a task was invoked.
+   */
+  bool run_one();
+
+  /**
+   * Find out whether any task is ready to run. Call with interrupts 
+   * disabled to get an answer that stays true.
+   */
+  inline bool has_ready() const;
+
+private:
+  void enqueue( Task &task );
+  void dequeue( Task &task );
+  Task *pop_highest();
+
+  uint32_t ready_mask;
+  Task *ready_head[num_priorities];
+  Task *ready_tail[num_priorities];
+};
+
+// Implement the inline functions here
+
+bool Scheduler::has_ready() const
+{
+  return ready_mask != 0;
+}
+
+} // namespace
+
+#endif
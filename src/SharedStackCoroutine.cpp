@@ -0,0 +1,136 @@
+/**
+ * @file SharedStackCoroutine.cpp
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ */
+
+#include "SharedStackCoroutine.h"
+
+#include "Coroutine_arm.h"
+#include "Tracing.h"
+
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+
+using namespace std;
+using namespace HC;
+using namespace Arm;
+
+SharedStack::SharedStack( byte *memory_, int size_ ) :
+  memory( memory_ ),
+  size( size_ ),
+  owner( nullptr ),
+  swapping( false )
+{
+  HC_ASSERT( ((uintptr_t)memory & 7) == 0, "shared stack %p is not 8-byte aligned", memory );
+}
+
+
+SharedStackCoroutine::SharedStackCoroutine( ChildFunction child_function_, 
+                                            SharedStack &shared_stack_, 
+                                            int save_buffer_size_ ) :
+  Coroutine( move(child_function_), claim(shared_stack_, this), shared_stack_.size ),
+  shared_stack( shared_stack_ ),
+  save_buffer_size( save_buffer_size_ ),
+  save_buffer( (byte *)malloc( save_buffer_size ) ),
+  saved_cls_bytes( 0 ),
+  saved_live_bytes( 0 )
+{
+  HC_ASSERT( save_buffer_size > 0 && save_buffer_size <= shared_stack.size, 
+             "save buffer size %d is not in 1..%d", save_buffer_size, shared_stack.size );
+  HC_ASSERT( save_buffer, "no memory for %d byte save buffer", save_buffer_size );
+}
+
+
+SharedStackCoroutine::~SharedStackCoroutine()
+{
+  RAII_PRIMASK lock;
+  if( shared_stack.owner == this )
+    shared_stack.owner = nullptr;
+  free( save_buffer );
+}
+
+
+void SharedStackCoroutine::make_child_stack_resident()
+{
+  // Quick check for the usual case of running again on our own stack
+  if( shared_stack.owner == this && !shared_stack.swapping )
+    return;
+
+  SharedStackCoroutine * const previous = swap_owner( shared_stack, this );
+  if( previous != this )
+  {
+    if( previous )
+      previous->save_out();
+    restore_in();
+  }
+  shared_stack.swapping = false;
+}
+
+
+byte *SharedStackCoroutine::claim( SharedStack &shared_stack, SharedStackCoroutine *claimant )
+{
+  // The base class constructor is about to set up the claimant's initial
+  // stack, so get the current owner out of the way first.
+  SharedStackCoroutine * const previous = swap_owner( shared_stack, claimant );
+  if( previous )
+    previous->save_out();
+  shared_stack.swapping = false;
+  return shared_stack.memory;
+}
+
+
+SharedStackCoroutine *SharedStackCoroutine::swap_owner( SharedStack &shared_stack, SharedStackCoroutine *claimant )
+{
+  // Only the change of owner needs interrupts masked. Marking the stack
+  // as swapping stops an interrupt from running anything on it until 
+  // the caller has finished copying and clears the flag.
+  RAII_PRIMASK lock;
+  HC_ASSERT( !shared_stack.swapping, "shared stack %p invoked while swapping", shared_stack.memory );
+  check_not_on( shared_stack );
+  SharedStackCoroutine * const previous = shared_stack.owner;
+  shared_stack.owner = claimant;
+  shared_stack.swapping = true;
+  return previous;
+}
+
+
+void SharedStackCoroutine::check_not_on( const SharedStack &shared_stack )
+{
+  const byte * const sp = (const byte *)get_sp();
+  HC_ASSERT( sp < shared_stack.memory || sp >= shared_stack.memory + shared_stack.size,
+             "cannot swap shared stack %p while running on it", shared_stack.memory );
+}
+
+
+void SharedStackCoroutine::save_out()
+{
+  // Once complete, there's nothing to keep
+  if( is_complete() )
+    return;
+
+  const byte * const stack_pointer = (const byte *)get_context_sp( child_context );
+  saved_cls_bytes = cls_top;
+  saved_live_bytes = (shared_stack.memory + shared_stack.size) - stack_pointer;
+  HC_ASSERT( saved_cls_bytes + saved_live_bytes <= save_buffer_size, 
+             "%d bytes in use do not fit %d byte save buffer", 
+             saved_cls_bytes + saved_live_bytes, save_buffer_size );
+
+  memcpy( save_buffer, shared_stack.memory, saved_cls_bytes );
+  memcpy( save_buffer + saved_cls_bytes, stack_pointer, saved_live_bytes );
+}
+
+
+void SharedStackCoroutine::restore_in()
+{
+  // Everything goes back where it came from, so pointers into the
+  // stack, including the frame pointer, are still good.
+  memcpy( shared_stack.memory, save_buffer, saved_cls_bytes );
+  memcpy( shared_stack.memory + shared_stack.size - saved_live_bytes,
+          save_buffer + saved_cls_bytes, saved_live_bytes );
+
+  // The last owner may have used the stack down to our CLS
+  place_stack_guard();
+}
@@ -0,0 +1,157 @@
+/**
+ * @file SharedStackCoroutine.h
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ *
+ * @brief Coroutines that take turns on one stack
+ */
+#ifndef SharedStackCoroutine_h
+#define SharedStackCoroutine_h
+
+#if __cplusplus <= 199711L
+  #error This library needs at least a C++11 compliant compiler
+#endif
+
+#include "HC_Config.h"
+
+#include "Coroutine.h"
+
+#include <cstdint>
+#include "Arduino.h"
+
+namespace HC
+{
+
+class SharedStackCoroutine;
+
+/**
+ * @brief A stack that several coroutines can run on.
+ *
+ * Only one of the coroutines, the _owner_, has its stack contents in
+ * place at a time. The memory is supplied by the caller, who continues
+ * to own it. It must be 8-byte aligned and must outlive the coroutines.
+ */
+class SharedStack
+{
+public:
+  /**
+   * Create a shared stack over the given memory.
+   *
+   * @param memory_ the memory; must be 8-byte aligned.
+   * @param size_ size of the memory in bytes.
+   */
+  SharedStack( byte *memory_, int size_ );
+
+private:
+  friend class SharedStackCoroutine;
+
+  byte * const memory;
+  const int size;
+  SharedStackCoroutine *owner;
+  volatile bool swapping;
+};
+
+
+/**
+ * @brief Shared stack with statically allocated memory.
+ *
+ * Declare as a global to get the memory in `.bss`, eg
+ *
+ * `HC::StaticSharedStack<2048> my_stack;`
+ *
+ * @tparam SIZE size of the stack in bytes.
+ */
+template<int SIZE>
+class StaticSharedStack : public SharedStack
+{
+public:
+  StaticSharedStack() :
+    SharedStack( stack, SIZE )
+  {
+  }
+
+private:
+  static_assert( SIZE % 8 == 0, "stack size must be a multiple of 8 bytes" );
+  byte stack[SIZE] __attribute__((aligned(8)));
+};
+
+
+/**
+ * @brief Coroutine that runs on a shared stack.
+ *
+ * When a different coroutine is to run on the stack, we copy out the
+ * parts of the owner's stack that are in use, ie its CLS at the bottom
+ * and its live frames from its stack pointer to the top, into a save
+ * buffer on the heap. Then we copy the new owner's parts back in, to
+ * the same addresses they came from. So each coroutine only costs what
+ * it has in use when it yields, rather than a whole stack. The price
+ * is the copying, whenever consecutive invocations on a stack are for
+ * different coroutines.
+ *
+ * The save buffer is allocated when the coroutine is created, so
+ * swapping never allocates. Its size must be given: enough for the 
+ * most the coroutine has in use when it yields, which 
+ * `estimate_stack_peak_usage()` can help find. Having more than that in
+ * use when evicted is an error. A buffer as big as the shared stack 
+ * always fits, but then nothing is saved over a stack each.
+ * Interrupts are only masked while the owner changes, not during the
+ * copying.
+ *
+ * Coroutines sharing a stack must not invoke each other, and must not
+ * be invoked from interrupts while one of them is running or the stack
+ * is being swapped. Either would mean evicting a coroutine from a
+ * stack we're running on, and is reported as an error. Stack usage
+ * estimates are for the shared stack as a whole.
+ */
+class SharedStackCoroutine : public Coroutine
+{
+public:
+  /**
+   * Create a coroutine on a shared stack. This may evict the stack's
+   * current owner.
+   *
+   * @param child_function_ the child function.
+   * @param shared_stack_ the stack to run on.
+   * @param save_buffer_size_ size of the save buffer in bytes; no more
+   * than the size of the shared stack.
+   */
+  SharedStackCoroutine( ChildFunction child_function_, 
+                        SharedStack &shared_stack_, 
+                        int save_buffer_size_ );
+
+  ~SharedStackCoroutine();
+
+  /**
+   * Get the size of our save buffer, ie the memory we use besides the
+   * shared stack.
+   */
+  inline int get_save_buffer_size() const;
+
+protected:
+  void make_child_stack_resident();
+
+private:
+  static byte *claim( SharedStack &shared_stack, SharedStackCoroutine *claimant );
+  static SharedStackCoroutine *swap_owner( SharedStack &shared_stack, SharedStackCoroutine *claimant );
+  static void check_not_on( const SharedStack &shared_stack );
+  void save_out();
+  void restore_in();
+
+  SharedStack &shared_stack;
+  const int save_buffer_size;
+  byte * const save_buffer;
+  int saved_cls_bytes;
+  int saved_live_bytes;
+};
+
+// Implement the inline functions here
+
+int SharedStackCoroutine::get_save_buffer_size() const
+{
+  return save_buffer_size;
+}
+
+} // namespace
+
+#endif
@@ -0,0 +1,52 @@
+/**
+ * @file StackPool.cpp
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ */
+
+#include "StackPool.h"
+
+#include "Coroutine_arm.h"
+#include "Tracing.h"
+
+#include <cstdint>
+
+using namespace std;
+using namespace HC;
+using namespace Arm;
+
+StackPool::StackPool( byte *arena, int arena_size, int block_size_ ) :
+  block_size( block_size_ ),
+  free_list( nullptr ),
+  free_count( 0 )
+{
+  HC_ASSERT( block_size % 8 == 0, "stack block size %d is not a multiple of 8", block_size );
+  HC_ASSERT( ((uintptr_t)arena & 7) == 0, "stack pool arena %p is not 8-byte aligned", arena );
+  
+  // Build the free list so that blocks come out lowest address first
+  for( int i = arena_size / block_size - 1; i >= 0; i-- )
+    release( arena + i * block_size );
+}
+
+
+byte *StackPool::allocate()
+{
+  RAII_PRIMASK lock;
+  FreeBlock * const block = free_list;
+  if( !block )
+    return nullptr;
+  free_list = block->next;
+  free_count--;
+  return (byte *)block;
+}
+
+
+void StackPool::release( byte *block )
+{
+  RAII_PRIMASK lock;
+  FreeBlock * const free_block = (FreeBlock *)block;
+  free_block->next = free_list;
+  free_list = free_block;
+  free_count++;
+}
@@ -0,0 +1,125 @@
+/**
+ * @file StackPool.h
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ * 
+ * @brief Fixed-size stack allocation for coroutines
+ */
+#ifndef StackPool_h
+#define StackPool_h
+
+#if __cplusplus <= 199711L
+  #error This library needs at least a C++11 compliant compiler
+#endif
+
+#include "HC_Config.h"
+
+#include <cstdint>
+#include "Arduino.h"
+
+namespace HC
+{
+
+/**
+ * @brief Pool of fixed-size coroutine stacks.
+ * 
+ * Hands out blocks of memory from an arena supplied by the user. Every
+ * block is the same size, so allocating and releasing are O(1) and 
+ * the arena can never become fragmented. The free blocks are kept on a
+ * singly linked list that is threaded through the blocks themselves, 
+ * so there is no bookkeeping overhead beyond the pool object.
+ * 
+ * A coroutine constructed with a pool takes one block for its stack, 
+ * and hands it back as soon as it completes. Allocate and release are
+ * safe to call from interrupt context.
+ */
+class StackPool
+{
+public:
+  /**
+   * Create a pool over the given memory.
+   * 
+   * @param arena memory to divide into blocks; must be 8-byte aligned.
+   * @param arena_size size of the arena in bytes.
+   * @param block_size_ size of each block in bytes; must be a multiple of 8.
+   */
+  StackPool( byte *arena, int arena_size, int block_size_ );
+  
+  /**
+   * Take a block from the pool.
+   * 
+   * @return pointer to the lowest address of the block, or `NULL` if 
+   * the pool is exhausted.
+   */
+  byte *allocate();
+
+  /**
+   * Return a block to the pool.
+   * 
+   * @param block a pointer previously returned by `allocate()`.
+   */
+  void release( byte *block );
+  
+  /**
+   * Get the size of the blocks in this pool.
+   */
+  inline int get_block_size() const;
+
+  /**
+   * Get the number of blocks not currently allocated.
+   */
+  inline int get_free_count() const;
+  
+private:
+  struct FreeBlock
+  {
+    FreeBlock *next;
+  };
+
+  const int block_size;
+  FreeBlock *free_list;
+  int free_count;
+};
+
+
+/**
+ * @brief Stack pool with a statically allocated arena.
+ * 
+ * Declare as a global to get the arena in `.bss`, eg 
+ * 
+ * `HC::StaticStackPool<512, 6> my_pool;`
+ * 
+ * @tparam BLOCK_SIZE size of each block in bytes.
+ * @tparam NUM_BLOCKS number of blocks in the pool.
+ */
+template<int BLOCK_SIZE, int NUM_BLOCKS>
+class StaticStackPool : public StackPool
+{
+public:
+  StaticStackPool() : 
+    StackPool( arena, sizeof(arena), BLOCK_SIZE )
+  {
+  }
+    
+private:
+  static_assert( BLOCK_SIZE % 8 == 0, "stack block size must be a multiple of 8 bytes" );
+  byte arena[BLOCK_SIZE * NUM_BLOCKS] __attribute__((aligned(8)));
+};
+
+// Implement the inline functions here
+
+int StackPool::get_block_size() const
+{
+  return block_size;
+}
+
+
+int StackPool::get_free_count() const
+{
+  return free_count;
+}
+
+} // namespace
+
+#endif
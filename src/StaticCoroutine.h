@@ -0,0 +1,71 @@
+/**
+ * @file StaticCoroutine.h
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ * 
+ * @brief Coroutine with its stack and child function held inline
+ */
+#ifndef StaticCoroutine_h
+#define StaticCoroutine_h
+
+#if __cplusplus <= 199711L
+  #error This library needs at least a C++11 compliant compiler
+#endif
+
+#include "HC_Config.h"
+
+#include "Coroutine.h"
+
+#include <utility>
+
+namespace HC
+{
+
+/**
+ * @brief Coroutine that needs no heap.
+ * 
+ * The stack and the child function object are both members, so a 
+ * global `StaticCoroutine` lives entirely in `.bss`, and the stack can
+ * be sized to suit the coroutine. The child function is called 
+ * directly rather than through `std::function`. Use like eg
+ * 
+ * `auto my_function = []{ ... };`\n
+ * `HC::StaticCoroutine<512, decltype(my_function)> my_task( my_function );`
+ * 
+ * @tparam STACK_SIZE size of the stack in bytes, including CLS.
+ * @tparam CALLABLE type of the child function object, eg a lambda.
+ */
+template<int STACK_SIZE, typename CALLABLE>
+class StaticCoroutine : public Coroutine
+{
+public:
+  /**
+   * Create an instance.
+   * 
+   * @param callable_ the child function object.
+   */
+  explicit StaticCoroutine( CALLABLE callable_ ) :
+    Coroutine( stack, STACK_SIZE ),
+    callable( std::move(callable_) )
+  {
+  }
+  
+protected:
+  void call_child_function()
+  {
+    callable();
+  }
+  
+private:
+  static_assert( STACK_SIZE % 8 == 0, "coroutine stack size must be a multiple of 8 bytes" );
+  
+  // Not initialised here: Coroutine's constructor prepares it before 
+  // we get a chance to.
+  byte stack[STACK_SIZE] __attribute__((aligned(8)));
+  CALLABLE callable;
+};
+
+} // namespace
+
+#endif
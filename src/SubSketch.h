@@ -13,6 +13,8 @@
   #error This library needs at least a C++11 compliant compiler
 #endif
 
+#include "HC_Config.h"
+
 #include "Coroutine.h"
 
 #define HC_SUB_SKETCH_TASK_IMPL(NAMESPACE, CLASSEXT) \
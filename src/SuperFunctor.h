@@ -10,6 +10,8 @@
 #ifndef SuperFunctor_h
 #define SuperFunctor_h
 
+#include "HC_Config.h"
+
 #include <utility>
 #include <cstddef>
 #include <cstdint>
@@ -9,10 +9,16 @@
 #ifndef SUPERFUNCTOR_ARM_H
 #define SUPERFUNCTOR_ARM_H
 
+#include "HC_Config.h"
+
 #include <utility>
 #include <cstddef>
 #include <cstdint>
 
+#ifdef HC_HOST_TEST
+// Built on a PC for the tests in test/host, which supply stand-ins
+#include "HostArm.h"
+#else
 namespace HC
 {
 namespace Arm
@@ -66,5 +72,6 @@ inline void *ptr_to_function_ptr( MachineInstruction *ptr )
 static const int pipeline_overshoot_instructions = 2;
 
 } } // namespace
+#endif
     
 #endif
\ No newline at end of file
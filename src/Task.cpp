@@ -7,14 +7,25 @@
 
 #include "Task.h"
 
-#include <functional>
+#include "Scheduler.h"
+#include "PriorityContext.h"
+#include "Coroutine_arm.h"
+
 #include <atomic>
 
 using namespace std;
 using namespace HC;
+using namespace Arm;
 
 Task::Task() :
-  magic( MAGIC )
+  magic( MAGIC ),
+  pending_hop( nullptr ),
+  scheduler( nullptr ),
+  next_ready( nullptr ),
+  priority( 0 ),
+  attached( false ),
+  queued( false ),
+  priority_context( nullptr )
 {
 }
 
@@ -24,17 +35,50 @@ void Task::operator()()
   check_valid_this();
 
   invoke();
-    
-  if( !hop_lambda )
+  
+  // Fast path: no hop requested
+  if( !pending_hop.load( memory_order_acquire ) )
     return;
-  auto local_hop_lambda = move(hop_lambda);
-  hop_lambda = std::function<void()>(); // clear it
+    
+  // Claim the hop, so that if running it causes re-entry, the re-entered
+  // functor won't see it. Run it from a copy, because the re-entered 
+  // task may replace or destroy the original, eg in Hopper::hop() or 
+  // ~Hopper.
+  HopLambda hop;
+  {
+    RAII_PRIMASK lock;
+    const HopLambda * const pending = pending_hop.load( memory_order_relaxed );
+    pending_hop.store( nullptr, memory_order_relaxed );
+    if( !pending )
+      return;
+    hop = *pending;
+  }
 
   // This will cause re-entry if a higher priority interrupt is enabled
   // than whatever is running us now. It's OK as long as we leave it at 
   // bottom of the function.
-  atomic_thread_fence(memory_order_release);
-  local_hop_lambda();    
+  run_hop_lambda( hop );    
+}
+
+
+bool Task::is_blocked() const
+{
+  return false;
+}
+
+
+void Task::wake()
+{
+  if( scheduler )
+    scheduler->wake( *this );
+  if( priority_context )
+    priority_context->trigger();
+}
+
+
+void Task::run_hop_lambda( const HopLambda &hop )
+{
+  hop();
 }
 
 
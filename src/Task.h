@@ -14,14 +14,21 @@
 #endif
 
 
+#include "HC_Config.h"
+
 #include "Tracing.h"
 #include "SuperFunctor.h"
+#include "InplaceFunction.h"
+#include "HopStats.h"
 
-#include <functional>
+#include <atomic>
 
 namespace HC
 {
 
+class Scheduler;
+class PriorityContext;
+
 /**
  * @brief Base class for tasks.
  * 
@@ -40,7 +47,9 @@ namespace HC
  * 
  * This class also provides support for hopping. A hop lambda may be  
  * provided to the class and will be invoked exactly once, just before
- * the next (or current) invocation returns, at a safe time.
+ * the next (or current) invocation returns, at a safe time. The 
+ * request is a single pointer, so it can be made from any context, and
+ * checking for one costs one load and one branch.
  * 
  * The reason for a separate Task class is that schedulers and the like
  * can work with `Task *`, rather than `Coroutine *` and will then be
@@ -49,6 +58,12 @@ namespace HC
 class Task : public SuperFunctor
 {
 public:
+  /**
+   * Type of hop lambdas. These are held without heap allocation, and
+   * are copied when they run, so they must be copyable.
+   */
+  typedef InplaceFunction<void(), 4 * sizeof(void *), true> HopLambda;
+
   /**
    * Create an instance.
    */ 
@@ -70,19 +85,78 @@ public:
    * Note that this code _is allowed_ to enable an interrupt whose
    * ISR may then _re-enter_ the task's functor interface. This is 
    * likely to happen when hopping from foreground to an interrupt that 
-   * is already pending. `invoke()` will not be re-entered.
+   * is already pending. `invoke()` will not be re-entered, and the 
+   * re-entered functor will not see this hop again.
    * 
-   * @param hop a lambda to be executed when the functor returns.
+   * The lambda is not copied here. The caller must keep it in place 
+   * until it runs, or until the hop is replaced or cancelled. It runs 
+   * from a copy, so the caller may then change or destroy it, even 
+   * from a re-entered functor.
+   * 
+   * @param hop a lambda to be executed when the functor returns, or 
+   * `nullptr` to cancel a pending hop.
    */  
-  inline void set_hop_lambda( std::function<void()> hop );
+  inline void set_hop( const HopLambda *hop );
+  
+  /**
+   * Report whether a hop has been given and has not yet run or been
+   * cancelled.
+   */
+  inline bool is_hop_pending() const;
+  
+  /**
+   * Report whether the task can make progress if invoked. A blocked 
+   * task will not be invoked by a scheduler.
+   * 
+   * @return true if blocked; the default is never blocked.
+   */
+  virtual bool is_blocked() const;
+  
+  /**
+   * Tell our scheduler or priority context, if we have one, that we 
+   * may no longer be blocked. May be called from interrupt context.
+   */
+  void wake();
+  
+#ifdef HC_HOP_STATS
+  /**
+   * Get the hop statistics for this task. These are recorded by 
+   * coroutines; see HopStats.h.
+   */
+  inline HopStats &get_hop_stats();
+#endif
   
 protected:
   inline void check_valid_this() const;
   virtual void invoke() = 0;
   
+  /**
+   * Run a hop lambda. Subclasses may over-ride to set up any context
+   * the lambda expects.
+   * 
+   * @param hop the hop lambda to run.
+   */
+  virtual void run_hop_lambda( const HopLambda &hop );
+  
 private:
+  friend class Scheduler;
+  friend class PriorityContext;
+  
   const uint32_t magic;
-  std::function<void()> hop_lambda;
+  std::atomic<const HopLambda *> pending_hop;
+#ifdef HC_HOP_STATS
+  HopStats hop_stats;
+#endif
+  
+  // Owned by the scheduler we're registered with, if any
+  Scheduler *scheduler;
+  Task *next_ready;
+  int priority;
+  bool attached;
+  bool queued;
+  
+  // Set while we're attached to a priority context
+  PriorityContext *priority_context;
 
   static const uint32_t MAGIC;
 };
@@ -94,11 +168,23 @@ void Task::check_valid_this() const
   HC_ASSERT( magic == MAGIC, "bad this pointer or object corrupted: %p", this );
 }
 
-void Task::set_hop_lambda( std::function<void()> hop )
+void Task::set_hop( const HopLambda *hop )
 {
-    hop_lambda = hop;
+  pending_hop.store( hop, std::memory_order_release );
 }
 
+bool Task::is_hop_pending() const
+{
+  return pending_hop.load( std::memory_order_acquire ) != nullptr;
+}
+
+#ifdef HC_HOP_STATS
+HopStats &Task::get_hop_stats()
+{
+  return hop_stats;
+}
+#endif
+
 } // namespace
 
 // NOTE: if super functors are disabled, we should be able to change the 
@@ -107,6 +193,7 @@ void Task::set_hop_lambda( std::function<void()> hop )
 void (*ISR_NAME##PTR)() = nullptr; \
 void ISR_NAME() \
 { \
+  HC_HOP_STATS_ISR_ENTRY(); \
   if( ISR_NAME##PTR ) \
     ISR_NAME##PTR(); \
 } \
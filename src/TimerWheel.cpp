@@ -0,0 +1,198 @@
+/**
+ * @file TimerWheel.cpp
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ */
+
+#include "TimerWheel.h"
+
+#include "Coroutine_arm.h"
+
+#include <cstdint>
+
+// We implement HC::delay() here, so we need the real delay()
+#undef delay
+
+#include "Arduino.h"
+
+using namespace std;
+using namespace HC;
+using namespace Arm;
+
+static TimerWheel system_timer_wheel;
+
+
+TimerWheel::TimerWheel() :
+  now( 0 )
+{
+  for( int level=0; level<num_levels; level++ )
+    for( int slot=0; slot<slots_per_level; slot++ )
+      slots[level][slot] = nullptr;
+}
+
+
+bool TimerWheel::add( Timer &timer )
+{
+  RAII_PRIMASK lock;
+  if( (int32_t)(timer.expiry - now) <= 0 )
+    return false;
+  file( &timer );
+  return true;
+}
+
+
+bool TimerWheel::remove( Timer &timer )
+{
+  // Timers only ever move down a level, so by looking from the top down
+  // we can let interrupts in between levels without missing it.
+  for( int level=num_levels-1; level>=0; level-- )
+  {
+    RAII_PRIMASK lock;
+    for( int slot=0; slot<slots_per_level; slot++ )
+    {
+      for( Timer **p = &slots[level][slot]; *p; p = &(*p)->next )
+      {
+        if( *p == &timer )
+        {
+          *p = timer.next;
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+
+void TimerWheel::advance( uint32_t tick )
+{
+  while( (int32_t)(tick - now) > 0 )
+  {
+    // Let other interrupts in between ticks
+    RAII_PRIMASK lock;
+    tick_once();
+  }
+}
+
+
+uint32_t TimerWheel::get_ticks_to_next_work( uint32_t limit ) const
+{
+  // Visit the slots of each level in the order they'll come round. Any
+  // non-empty one is work, be it firing or re-filing.
+  uint32_t best = limit;
+  for( int level=0; level<num_levels; level++ )
+  {
+    const int shift = level*level_bits;
+    const uint32_t first = ((now >> shift) + 1) << shift;
+    for( int i=0; i<slots_per_level; i++ )
+    {
+      const uint32_t tick = first + ((uint32_t)i << shift);
+      if( tick - now >= best )
+        break;
+      if( slots[level][(tick >> shift) & (slots_per_level-1)] )
+      {
+        best = tick - now;
+        break;
+      }
+    }
+  }
+  return best;
+}
+
+
+void TimerWheel::file( Timer *timer )
+{
+  // Find the lowest level that reaches the expiry without wrapping.
+  // Beyond the top level, use the top level slot that comes round
+  // last; we'll re-file from there.
+  const uint32_t delta = timer->expiry - now;
+  int level = 0;
+  while( level < num_levels-1 && delta >= (1U << ((level+1)*level_bits)) )
+    level++;
+  uint32_t index = timer->expiry >> (level*level_bits);
+  if( level == num_levels-1 && delta >= (1U << (num_levels*level_bits)) )
+    index = (now >> (level*level_bits)) - 1;
+  Timer **slot = &slots[level][index & (slots_per_level-1)];
+  timer->next = *slot;
+  *slot = timer;
+}
+
+
+void TimerWheel::cascade( int level )
+{
+  const uint32_t index = (now >> (level*level_bits)) & (slots_per_level-1);
+  Timer *timer = slots[level][index];
+  slots[level][index] = nullptr;
+  while( timer )
+  {
+    Timer * const next = timer->next;
+    file( timer );
+    timer = next;
+  }
+}
+
+
+void TimerWheel::tick_once()
+{
+  now++;
+
+  // Each level's slot comes round when the levels below it wrap
+  for( int level=1; level<num_levels; level++ )
+  {
+    if( now & ((1U << (level*level_bits)) - 1) )
+      break;
+    cascade( level );
+  }
+
+  // Everything in this slot expires now
+  const uint32_t index = now & (slots_per_level-1);
+  Timer *timer = slots[0][index];
+  slots[0][index] = nullptr;
+  while( timer )
+  {
+    Timer * const next = timer->next;
+    timer->expired.set(); // timer may go away after this
+    timer = next;
+  }
+}
+
+
+TimerWheel &HC::get_system_timer_wheel()
+{
+  return system_timer_wheel;
+}
+
+
+void HC::sleep_until( uint32_t deadline )
+{
+  TimerWheel::Timer timer;
+  timer.expiry = deadline;
+  if( system_timer_wheel.add( timer ) )
+    timer.expired.wait();
+}
+
+
+void HC::sleep_for( uint32_t ms )
+{
+  sleep_until( millis() + ms );
+}
+
+
+void HC::delay( unsigned long ms )
+{
+  if( me() )
+    sleep_for( ms );
+  else
+    ::delay( ms );
+}
+
+
+// Called by the core's SysTick handler just before it increments the
+// millisecond count, so bring the system wheel up to what millis() is
+// about to return. Returning 0 lets the core carry on as usual.
+extern "C" int sysTickHook(void)
+{
+  system_timer_wheel.advance( millis() + 1 );
+  return 0;
+}
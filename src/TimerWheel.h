@@ -0,0 +1,155 @@
+/**
+ * @file TimerWheel.h
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ *
+ * @brief Timer wheel, and sleeping for coroutines
+ */
+#ifndef TimerWheel_h
+#define TimerWheel_h
+
+#if __cplusplus <= 199711L
+  #error This library needs at least a C++11 compliant compiler
+#endif
+
+#include "HC_Config.h"
+
+#include "Coroutine.h"
+#include "Event.h"
+
+#include <cstdint>
+
+namespace HC
+{
+
+/**
+ * @brief Hierarchical timer wheel.
+ *
+ * Holds timers, each of which sets its flag when the wheel reaches its
+ * expiry tick. The wheel has `num_levels` levels of `slots_per_level`
+ * slots. Level 0 has a slot per tick; each higher level has a slot per
+ * revolution of the level below. A timer goes into the lowest level
+ * that can reach its expiry, and drops down a level each time the slot
+ * it's in comes round, until it fires from level 0. So adding a timer
+ * is O(1), and each tick only visits the timers that are in the slots
+ * that come round on that tick. Timers further away than the whole
+ * wheel wait in the top level and are re-filed as it goes round.
+ *
+ * Timers are intrusive, so the wheel never allocates. A timer must stay
+ * in place until it has fired or been removed.
+ *
+ * The wheel knows nothing of where ticks come from: `advance()` may be
+ * driven from SysTick (as for the system wheel used by `sleep_for()`)
+ * or by any other clock, including a host-side stand-in. Everything
+ * may be called from interrupt context.
+ */
+class TimerWheel
+{
+public:
+  /**
+   * @brief A timer that can be added to a wheel.
+   */
+  struct Timer
+  {
+    Timer *next;
+    uint32_t expiry;
+    Flag expired;
+  };
+
+  static const int level_bits = 4;
+  static const int slots_per_level = 1 << level_bits;
+  static const int num_levels = 4;
+
+  /**
+   * Create a wheel whose current tick is zero.
+   */
+  TimerWheel();
+
+  /**
+   * Add a timer. Its `expiry` member must already be set.
+   *
+   * @param timer the timer, which must not be on a wheel.
+   * @return false, and the timer is not added, if the expiry tick is
+   * not in the future.
+   */
+  bool add( Timer &timer );
+
+  /**
+   * Take a timer off the wheel without firing it. We don't keep track
+   * of which slot a timer is in, so this looks through them all; it's
+   * for tidying up, not for frequent use.
+   *
+   * @param timer the timer.
+   * @return false if the timer was not on the wheel, eg because it has
+   * already fired.
+   */
+  bool remove( Timer &timer );
+
+  /**
+   * Move the wheel forward one tick at a time, firing timers as we go.
+   *
+   * @param tick the tick to advance to.
+   */
+  void advance( uint32_t tick );
+
+  /**
+   * Find how far ahead the wheel next has work to do, ie a timer to 
+   * fire or a slot to re-file. Ticks before then can be skipped and 
+   * caught up later by one call to `advance()`. Call with interrupts 
+   * disabled to get an answer that stays true.
+   * 
+   * @param limit the furthest ahead to look.
+   * @return number of ticks from now, up to `limit`.
+   */
+  uint32_t get_ticks_to_next_work( uint32_t limit ) const;
+
+  /**
+   * Get the current tick.
+   */
+  inline uint32_t get_now() const;
+
+private:
+  void file( Timer *timer );
+  void cascade( int level );
+  void tick_once();
+
+  volatile uint32_t now;
+  Timer *slots[num_levels][slots_per_level];
+};
+
+
+/**
+ * Get the system timer wheel, which ticks along with `millis()`.
+ */
+TimerWheel &get_system_timer_wheel();
+
+/**
+ * Sleep until `millis()` reaches a deadline. In a coroutine, this
+ * parks the coroutine on the system timer wheel, so it is not resumed
+ * until the deadline. Outside of any coroutine it spins.
+ *
+ * A coroutine that has hopped onto an interrupt will next run when that
+ * interrupt occurs after the deadline.
+ *
+ * @param deadline the deadline, in `millis()` units.
+ */
+void sleep_until( uint32_t deadline );
+
+/**
+ * Sleep for a number of milliseconds; see `sleep_until()`.
+ *
+ * @param ms the time to sleep for.
+ */
+void sleep_for( uint32_t ms );
+
+// Implement the inline functions here
+
+uint32_t TimerWheel::get_now() const
+{
+  return now;
+}
+
+} // namespace
+
+#endif
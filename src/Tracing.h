@@ -10,6 +10,8 @@
 #ifndef Tracing_h
 #define Tracing_h
 
+#include "HC_Config.h"
+
 #include <cstring>
 #include <functional>
 #include <cstdint>
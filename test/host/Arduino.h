@@ -0,0 +1,120 @@
+/**
+ * @file Arduino.h
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ * 
+ * @brief Host stand-in for the parts of the Arduino SAMD core that the
+ * library uses.
+ *
+ * `SERCOM` and `::Uart` keep the same interface as the core's, but 
+ * work on the mock SERCOM in MockHardware.cpp. `::Uart` keeps count of 
+ * calls to its interrupt handler, which takes any character that's 
+ * waiting, as the core's does.
+ */
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include "sam.h"
+
+typedef uint8_t byte;
+
+unsigned long millis();
+unsigned long micros();
+void delay( unsigned long ms );
+extern "C" void yield( void );
+
+#define SERIAL_8N1 0x11
+
+enum SercomRXPad
+{
+  SERCOM_RX_PAD_0 = 0,
+  SERCOM_RX_PAD_1,
+  SERCOM_RX_PAD_2,
+  SERCOM_RX_PAD_3
+};
+
+enum SercomUartTXPad
+{
+  UART_TX_PAD_0 = 0,
+  UART_TX_PAD_2,
+  UART_TX_RTS_CTS_PAD_0_2_3
+};
+
+class SERCOM
+{
+public:
+  explicit SERCOM( Sercom *s );
+  
+  void initUART();
+  void resetUART();
+  bool isUARTError();
+  void acknowledgeUARTError();
+  bool isFrameErrorUART();
+  void clearFrameErrorUART();
+  bool isBufferOverflowErrorUART();
+  bool isParityErrorUART();
+  void clearStatusUART();
+  bool availableDataUART();
+  bool isDataRegisterEmptyUART();
+  uint8_t readDataUART();
+  int writeDataUART( uint8_t data );
+  void enableDataRegisterEmptyInterruptUART();
+  void disableDataRegisterEmptyInterruptUART();
+  
+private:
+  Sercom * const sercom;
+};
+
+extern SERCOM sercom0;
+
+class Print
+{
+public:
+  virtual ~Print() = default;
+  virtual size_t write( uint8_t data ) = 0;
+  virtual size_t write( const uint8_t *buffer, size_t size );
+  size_t write( const char *str );
+};
+
+class HardwareSerial : public Print
+{
+public:
+  virtual void begin( unsigned long baudRate ) = 0;
+  virtual void end() = 0;
+};
+
+class Uart : public HardwareSerial
+{
+public:
+  Uart( SERCOM *_s, uint8_t _pinRX, uint8_t _pinTX, SercomRXPad _padRX, SercomUartTXPad _padTX );
+  Uart( SERCOM *_s, uint8_t _pinRX, uint8_t _pinTX, SercomRXPad _padRX, SercomUartTXPad _padTX, uint8_t _pinRTS, uint8_t _pinCTS );
+  void begin( unsigned long baudRate );
+  void begin( unsigned long baudrate, uint16_t config );
+  void end();
+  void flush();
+  size_t write( uint8_t data );
+  using Print::write;
+  void IrqHandler();
+  
+  static int irq_handler_calls;
+  static int irq_handler_characters;
+
+private:
+  SERCOM * const sercom;
+};
+
+class HostSerial
+{
+public:
+  void println( const char *message );
+};
+
+extern HostSerial Serial;
+
+#endif
@@ -0,0 +1,252 @@
+/**
+ * @file CoroutineTest.cpp
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ *
+ * @brief Tests for Coroutine and the things built on it, running on the
+ * host's context switch.
+ */
+
+#include "Coroutine.h"
+#include "Generator.h"
+#include "Hopper.h"
+#include "SharedStackCoroutine.h"
+
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+
+using namespace std;
+using namespace HC;
+
+// x86-64 frames are bigger than Arm ones; see SwitchBenchmark.cpp
+static byte stack_memory[16384] __attribute__((aligned(16)));
+
+static int failures = 0;
+
+#define CHECK( COND ) do { if( !(COND) ) { fprintf( stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #COND ); failures++; } } while(0)
+
+
+static void __attribute__((noinline)) use_stack( int bytes )
+{
+  volatile byte frame[bytes];
+  for( int i=0; i<bytes; i++ )
+    frame[i] = 0;
+  (void)frame;
+}
+
+
+static void test_stack_peak_usage()
+{
+  Coroutine coroutine( []
+  {
+    use_stack( 4096 );
+    Coroutine::yield();
+    use_stack( 8192 );
+    Coroutine::yield();
+    use_stack( 1024 );
+  }, stack_memory, sizeof(stack_memory) );
+
+  // Only the host's entry frame so far
+  CHECK( coroutine.estimate_stack_peak_usage() < 64 );
+
+  // The rest is the library's frames and the entry frame
+  coroutine();
+  int usage = coroutine.estimate_stack_peak_usage();
+  CHECK( usage >= 4096 && usage < 4096 + 2048 );
+  CHECK( coroutine.estimate_stack_peak_usage() == usage );
+
+  coroutine();
+  usage = coroutine.estimate_stack_peak_usage();
+  CHECK( usage >= 8192 && usage < 8192 + 2048 );
+
+  // Only ever goes up
+  coroutine();
+  CHECK( coroutine.is_complete() );
+  CHECK( coroutine.estimate_stack_peak_usage() == usage );
+}
+
+
+static void test_generator_early_break()
+{
+  int produced = 0;
+  {
+    Generator<int> counter( [&]( Generator<int> &g )
+    {
+      for( int i=0; i<10; i++ )
+      {
+        produced++;
+        g.yield_value( i );
+      }
+    }, stack_memory, sizeof(stack_memory) );
+
+    int sum = 0;
+    for( int &i : counter )
+    {
+      sum += i;
+      if( i == 3 )
+        break;
+    }
+    CHECK( sum == 0+1+2+3 );
+    CHECK( !counter.is_complete() );
+  }
+
+  // Destroyed without running the rest of the body
+  CHECK( produced == 4 );
+}
+
+
+static void test_generator_cancel()
+{
+  Generator<int> counter( []( Generator<int> &g )
+  {
+    for( int i=0; i<3; i++ )
+      g.yield_value( i );
+  }, stack_memory, sizeof(stack_memory) );
+
+  CHECK( counter.next() && counter.value() == 0 );
+  counter.cancel();
+  CHECK( counter.is_complete() );
+  CHECK( !counter.next() );
+
+  // Starts afresh
+  counter.restart();
+  int count = 0;
+  for( int &i : counter )
+    CHECK( i == count++ );
+  CHECK( count == 3 );
+}
+
+
+static void test_shared_stack()
+{
+  // Each keeps a running total in a frame on the shared stack, which is
+  // copied out and back in whenever another one runs
+  static StaticSharedStack<16384> shared_stack;
+  const int num_tasks = 3;
+  int totals[num_tasks] = {};
+  SharedStackCoroutine *tasks[num_tasks];
+  for( int i=0; i<num_tasks; i++ )
+  {
+    int * const total = &totals[i];
+    tasks[i] = new SharedStackCoroutine( [i, total]
+    {
+      volatile int frame[16] = {};
+      for( int n=0; n<5; n++ )
+      {
+        frame[n] = i + 1;
+        *total = frame[0] + frame[1] + frame[2] + frame[3] + frame[4];
+        Coroutine::yield();
+      }
+    }, shared_stack, 1024 );
+    CHECK( tasks[i]->get_save_buffer_size() == 1024 );
+  }
+
+  for( int n=0; n<5; n++ )
+    for( int i=0; i<num_tasks; i++ )
+      (*tasks[i])();
+  for( int i=0; i<num_tasks; i++ )
+  {
+    CHECK( totals[i] == 5 * (i + 1) );
+    (*tasks[i])();
+    CHECK( tasks[i]->is_complete() );
+    delete tasks[i];
+  }
+}
+
+
+// Attach lambdas that log when they start and finish, and re-enter the
+// task in between if asked to, as an interrupt they enable might
+static Coroutine *hop_task;
+static bool hop_reenter;
+static string hop_log;
+
+static Task::HopLambda make_attach( int tag )
+{
+  return [tag]
+  {
+    hop_log += "+" + to_string( tag );
+    if( hop_reenter )
+    {
+      hop_reenter = false;
+      (*hop_task)();
+    }
+    hop_log += "-" + to_string( tag );
+  };
+}
+
+
+static void test_hop_replaced_during_reentry()
+{
+  Coroutine coroutine( []
+  {
+    Hopper hopper( make_attach( 1 ), []{} );
+    Coroutine::yield();
+    hopper.hop( make_attach( 2 ), []{} );
+    Coroutine::yield();
+  }, stack_memory, sizeof(stack_memory) );
+  hop_task = &coroutine;
+  hop_reenter = true;
+  hop_log.clear();
+
+  // The first attach re-enters, which replaces it with the second, 
+  // which the re-entered functor runs
+  coroutine();
+  CHECK( hop_log == "+1+2-2-1" );
+
+  coroutine();
+  CHECK( coroutine.is_complete() );
+}
+
+
+static void __attribute__((noinline)) hop_and_yield()
+{
+  Hopper hopper( make_attach( 3 ), []{} );
+  Coroutine::yield();
+}
+
+
+static void test_hop_destroyed_during_reentry()
+{
+  Coroutine coroutine( []
+  {
+    hop_and_yield();
+    // Over-write where the Hopper was
+    use_stack( 1024 );
+    Coroutine::yield();
+  }, stack_memory, sizeof(stack_memory) );
+  hop_task = &coroutine;
+  hop_reenter = true;
+  hop_log.clear();
+
+  coroutine();
+  CHECK( hop_log == "+3-3" );
+
+  coroutine();
+  CHECK( coroutine.is_complete() );
+}
+
+
+#define RUN( TEST ) do { fprintf( stderr, "%s\n", #TEST ); TEST; } while(0)
+
+int main()
+{
+  // Fail rather than hang
+  alarm( 30 );
+
+  RUN( test_stack_peak_usage() );
+  RUN( test_generator_early_break() );
+  RUN( test_generator_cancel() );
+  RUN( test_shared_stack() );
+  RUN( test_hop_replaced_during_reentry() );
+  RUN( test_hop_destroyed_during_reentry() );
+
+  if( failures )
+  {
+    fprintf( stderr, "%d failed\n", failures );
+    return 1;
+  }
+  fprintf( stderr, "all passed\n" );
+  return 0;
+}
@@ -0,0 +1,145 @@
+/**
+ * @file HostArm.h
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ * 
+ * @brief Host stand-ins for the Arm-specifics in Coroutine_arm.h and
+ * SuperFunctor_arm.h.
+ *
+ * Coroutines run on the host with an x86-64 context switch (see 
+ * HostArm.S), and the TR is a thread-local variable which the switch 
+ * saves and loads. Interrupts are run by the mock hardware's thread 
+ * (see MockHardware.h), and PRIMASK is a recursive mutex which that 
+ * thread holds while it runs them.
+ */
+#ifndef HostArm_h
+#define HostArm_h
+
+#include <cstdint>
+#include <mutex>
+
+namespace HC
+{
+namespace Arm
+{
+
+/**
+ * Register context for a suspended thread of execution. The 
+ * callee-save registers are on the stack, so only the stack pointer 
+ * and the TR are held here.
+ */
+struct Context
+{
+  void *sp;
+  void *tr;
+};
+
+// Defined in HostFakes.cpp
+extern thread_local void *host_tr;
+
+// In HostArm.S. Pushes the callee-save registers, saves the stack 
+// pointer into `*from_sp`, switches to `to_sp` and pops them from there.
+extern "C" void hc_host_switch_stack( void **from_sp, void *to_sp );
+extern "C" void hc_host_context_entry();
+
+inline void switch_context( Context *from, const Context *to )
+{
+  from->tr = host_tr;
+  host_tr = to->tr;
+  hc_host_switch_stack( &from->sp, to->sp );
+}
+
+/**
+ * Make a context that, when switched to, starts running a function on 
+ * a new stack. The stack gets the frame that `hc_host_switch_stack()` 
+ * pops: the callee-save registers, with the function and its argument 
+ * in r12 and r13, then a return into `hc_host_context_entry()`.
+ */
+inline void prepare_entry_context( Context &context, void *stack_top, void (*function)(void *), void *arg )
+{
+  // The entry calls the function with the stack 16-byte aligned
+  void **frame = (void **)( (uintptr_t)stack_top & ~(uintptr_t)15 ) - 7;
+  for( int i=0; i<6; i++ )
+    frame[i] = nullptr;
+  frame[2] = arg; // r13
+  frame[3] = (void *)function; // r12
+  frame[6] = (void *)&hc_host_context_entry;
+  context.sp = frame;
+  context.tr = nullptr;
+}
+
+inline void *get_context_sp( const Context &context )
+{
+  return context.sp;
+}
+
+inline void set_context_sp( Context &context, void *new_sp )
+{
+  context.sp = new_sp;
+}
+
+inline void *get_context_tr( const Context &context )
+{
+  return context.tr;
+}
+
+inline void set_context_tr( Context &context, void *new_tr )
+{
+  context.tr = new_tr;
+}
+
+inline void *get_tr()
+{
+  return host_tr;
+}
+
+inline void set_tr( void *tr )
+{
+  host_tr = tr;
+}
+
+inline void *get_sp()
+{
+  return __builtin_frame_address(0);
+}
+
+bool is_in_interrupt();
+
+inline uint32_t get_cycle_count()
+{
+  return 0;
+}
+
+inline uint32_t get_cycles_between( uint32_t start, uint32_t end )
+{
+  return end - start;
+}
+
+inline void enable_cycle_count()
+{
+}
+
+// SuperFunctor only needs the sizes; see HostFakes.cpp
+typedef uint16_t MachineInstruction;
+#define SUPER_FUNCTOR_TRAMPOLINE_SIZE 4
+
+std::recursive_mutex &get_primask();
+
+class RAII_PRIMASK
+{
+public:
+  inline RAII_PRIMASK()
+  {
+    get_primask().lock();
+  }
+  
+  inline ~RAII_PRIMASK()
+  {
+    get_primask().unlock();
+  }
+};
+
+} } // namespace
+
+#endif
@@ -0,0 +1,63 @@
+/**
+ * @file HostFakes.cpp
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ *
+ * @brief Host stand-ins for the parts of the library that only work on 
+ * Arm.
+ *
+ * SuperFunctor builds its trampolines at run time in Arm code, so here 
+ * each instance is given one of a fixed set of functions instead. 
+ * Integration.cpp isn't built, since the mock Arduino core has its own 
+ * `yield()`.
+ */
+
+#include "Coroutine.h"
+#include "SuperFunctor.h"
+#include "Tracing.h"
+
+
+using namespace std;
+using namespace HC;
+
+thread_local void *HC::Arm::host_tr = nullptr;
+
+
+void bring_in_Integration()
+{
+}
+
+
+static const int max_super_functors = 8;
+static SuperFunctor *super_functors[max_super_functors];
+static int num_super_functors = 0;
+
+
+SuperFunctor::SuperFunctor() :
+  entrypoint_fpt( nullptr )
+{
+}
+
+
+SuperFunctor::operator EntryPointFP()
+{
+  static const EntryPointFP entry_points[max_super_functors] = 
+  {
+    []{ (*super_functors[0])(); },
+    []{ (*super_functors[1])(); },
+    []{ (*super_functors[2])(); },
+    []{ (*super_functors[3])(); },
+    []{ (*super_functors[4])(); },
+    []{ (*super_functors[5])(); },
+    []{ (*super_functors[6])(); },
+    []{ (*super_functors[7])(); }
+  };
+  
+  for( int i=0; i<num_super_functors; i++ )
+    if( super_functors[i] == this )
+      return entry_points[i];
+  HC_ASSERT( num_super_functors < max_super_functors, "too many SuperFunctors" );
+  super_functors[num_super_functors] = this;
+  return entry_points[num_super_functors++];
+}
@@ -0,0 +1,877 @@
+/**
+ * @file MockHardware.cpp
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ */
+
+#include "MockHardware.h"
+
+#include "HostArm.h"
+#include "Coroutine.h"
+#include "Arduino.h"
+#include "sam.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+// SERCOM USART bits we use that sam.h doesn't need
+static const uint8_t INTFLAG_DRE = 1U << 0;
+static const uint8_t INTFLAG_RXC = 1U << 2;
+static const uint8_t INTFLAG_ERROR = 1U << 7;
+static const uint8_t STATUS_FERR = 1U << 1;
+static const uint8_t STATUS_BUFOVF = 1U << 2;
+
+namespace
+{
+
+struct RxEvent
+{
+  enum Kind { CHARACTER, FRAME_ERROR, OVERRUN, ACTION } kind;
+  uint8_t data;
+  Mock::When when;
+  function<void()> run;
+};
+
+struct Usart
+{
+  bool enabled;
+  uint8_t inten;
+  uint8_t intflag;
+  uint8_t status;
+  uint8_t rx_data;
+  bool tx_full;
+  uint8_t tx_data;
+};
+
+struct Channel
+{
+  bool enabled;
+  uint32_t chctrlb;
+  uint8_t inten;
+  uint8_t intflag;
+  DmacDescriptor desc;
+};
+
+Usart usart;
+Channel channels[DMAC_CH_NUM];
+uint16_t dmac_ctrl;
+bool nvic_enabled[32];
+deque<RxEvent> rx_events;
+string transmitted;
+bool hold_dma;
+int beats_to_bus_error = -1;
+
+void (**sercom_vector_p)();
+void (**dmac_vector_p)();
+thread hardware_thread;
+atomic<bool> running( false );
+atomic<unsigned> steps( 0 );
+thread_local bool in_interrupt = false;
+
+const auto start_time = chrono::steady_clock::now();
+
+// Everything here is shared with the code under test
+inline recursive_mutex &lock()
+{
+  return HC::Arm::get_primask();
+}
+
+
+void fail( const char *message )
+{
+  fprintf( stderr, "mock hardware: %s\n", message );
+  abort();
+}
+
+
+Channel &get_channel()
+{
+  const uint8_t id = host_dmac.CHID.reg;
+  if( id >= DMAC_CH_NUM )
+    fail( "bad CHID" );
+  return channels[id];
+}
+
+
+uint32_t get_trigger( const Channel &channel )
+{
+  return (channel.chctrlb & DMAC_CHCTRLB_TRIGSRC_Msk) >> 8;
+}
+
+
+void write_back( int id )
+{
+  auto writeback = (volatile DmacDescriptor *)(uintptr_t)host_dmac.WRBADDR.reg;
+  writeback[id].BTCNT.reg = channels[id].desc.BTCNT.reg;
+}
+
+
+void reset_channel( Channel &channel )
+{
+  channel.enabled = false;
+  channel.chctrlb = 0;
+  channel.inten = 0;
+  channel.intflag = 0;
+}
+
+
+void transmit( uint8_t data )
+{
+  if( !(usart.intflag & INTFLAG_DRE) )
+    fail( "DATA written while not empty" );
+  usart.tx_data = data;
+  usart.tx_full = true;
+  usart.intflag &= ~INTFLAG_DRE;
+}
+
+
+uint8_t receive_data()
+{
+  usart.intflag &= ~INTFLAG_RXC;
+  return usart.rx_data;
+}
+
+
+// The DMAC reads and writes the SERCOM through its DATA register, and
+// memory through its 32-bit address
+uint8_t dma_read( uint32_t address )
+{
+  if( address == (uint32_t)(uintptr_t)&host_sercom0.USART.DATA.reg )
+    return receive_data();
+  return *(volatile uint8_t *)(uintptr_t)address;
+}
+
+
+void dma_write( uint32_t address, uint8_t data )
+{
+  if( address == (uint32_t)(uintptr_t)&host_sercom0.USART.DATA.reg )
+    transmit( data );
+  else
+    *(volatile uint8_t *)(uintptr_t)address = data;
+}
+
+
+void dma_beat( int id )
+{
+  // A bus error stops the channel, as the end of the block does
+  Channel &channel = channels[id];
+  if( beats_to_bus_error == 0 )
+  {
+    beats_to_bus_error = -1;
+    channel.enabled = false;
+    write_back( id );
+    channel.intflag |= DMAC_CHINTFLAG_TERR;
+    return;
+  }
+  if( beats_to_bus_error > 0 )
+    beats_to_bus_error--;
+
+  // Incrementing addresses are the end of the block
+  DmacDescriptor &desc = channel.desc;
+  uint32_t source = desc.SRCADDR.reg;
+  if( desc.BTCTRL.reg & DMAC_BTCTRL_SRCINC )
+    source -= desc.BTCNT.reg;
+  uint32_t dest = desc.DSTADDR.reg;
+  if( desc.BTCTRL.reg & DMAC_BTCTRL_DSTINC )
+    dest -= desc.BTCNT.reg;
+  dma_write( dest, dma_read( source ) );
+
+  if( --desc.BTCNT.reg == 0 )
+  {
+    channel.enabled = false;
+    write_back( id );
+    channel.intflag |= DMAC_CHINTFLAG_TCMPL;
+  }
+}
+
+
+bool is_listening()
+{
+  if( !usart.enabled )
+    return false;
+  if( dmac_ctrl & DMAC_CTRL_DMAENABLE )
+    for( const Channel &channel : channels )
+      if( channel.enabled && get_trigger( channel ) == SERCOM0_DMAC_ID_RX )
+        return true;
+  return (usart.inten & INTFLAG_RXC) && nvic_enabled[SERCOM0_IRQn] && *sercom_vector_p;
+}
+
+
+void deliver_rx_event()
+{
+  if( rx_events.empty() )
+    return;
+  RxEvent &event = rx_events.front();
+  const bool rx_full = usart.intflag & INTFLAG_RXC;
+  if( event.kind == RxEvent::ACTION )
+  {
+    if( rx_full )
+      return;
+    function<void()> run = event.run;
+    rx_events.pop_front();
+    run();
+    return;
+  }
+  if( event.when != Mock::WHEN_NOW && (rx_full || !is_listening()) )
+    return;
+
+  if( usart.enabled )
+  {
+    if( event.kind == RxEvent::OVERRUN || rx_full )
+    {
+      usart.status |= STATUS_BUFOVF;
+      usart.intflag |= INTFLAG_ERROR;
+    }
+    else
+    {
+      usart.rx_data = event.data;
+      usart.intflag |= INTFLAG_RXC;
+      if( event.kind == RxEvent::FRAME_ERROR )
+      {
+        usart.status |= STATUS_FERR;
+        usart.intflag |= INTFLAG_ERROR;
+      }
+    }
+    hold_dma = (event.when == Mock::WHEN_LISTENING_ISR_FIRST);
+  }
+  rx_events.pop_front();
+}
+
+
+void run_dma()
+{
+  if( !(dmac_ctrl & DMAC_CTRL_DMAENABLE) )
+    return;
+  for( int id=0; id<DMAC_CH_NUM; id++ )
+  {
+    const Channel &channel = channels[id];
+    if( !channel.enabled )
+      continue;
+    const uint32_t trigger = get_trigger( channel );
+    if( (trigger == SERCOM0_DMAC_ID_RX && (usart.intflag & INTFLAG_RXC)) ||
+        (trigger == SERCOM0_DMAC_ID_TX && (usart.intflag & INTFLAG_DRE)) )
+      dma_beat( id );
+  }
+}
+
+
+bool is_dmac_pending()
+{
+  for( const Channel &channel : channels )
+    if( channel.intflag & channel.inten )
+      return true;
+  return false;
+}
+
+
+void interrupt( void (**vector_p)() )
+{
+  in_interrupt = true;
+  (*vector_p)();
+  in_interrupt = false;
+}
+
+
+void run_interrupts()
+{
+  if( nvic_enabled[SERCOM0_IRQn] && *sercom_vector_p && (usart.inten & usart.intflag) )
+    interrupt( sercom_vector_p );
+  if( nvic_enabled[DMAC_IRQn] && *dmac_vector_p && is_dmac_pending() )
+    interrupt( dmac_vector_p );
+}
+
+
+void step()
+{
+  if( usart.tx_full )
+  {
+    transmitted += (char)usart.tx_data;
+    usart.tx_full = false;
+    usart.intflag |= INTFLAG_DRE;
+  }
+  deliver_rx_event();
+  if( !hold_dma )
+    run_dma();
+  run_interrupts();
+  hold_dma = false;
+}
+
+
+void run()
+{
+  while( running )
+  {
+    {
+      lock_guard<recursive_mutex> guard( lock() );
+      step();
+    }
+    steps++;
+    this_thread::yield();
+  }
+}
+
+
+void push( RxEvent event )
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  rx_events.push_back( event );
+}
+
+// Register access from the code under test
+
+uint16_t read_ctrl( int )
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  return dmac_ctrl;
+}
+
+
+void write_ctrl( int, uint16_t value )
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  if( value & DMAC_CTRL_SWRST )
+  {
+    for( Channel &channel : channels )
+      reset_channel( channel );
+    dmac_ctrl = 0;
+  }
+  else
+  {
+    dmac_ctrl = value;
+  }
+}
+
+
+uint8_t read_chctrla( int )
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  return get_channel().enabled ? DMAC_CHCTRLA_ENABLE : 0;
+}
+
+
+void write_chctrla( int, uint8_t value )
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  Channel &channel = get_channel();
+  const int id = &channel - channels;
+  if( value & DMAC_CHCTRLA_SWRST )
+  {
+    reset_channel( channel );
+  }
+  else if( (value & DMAC_CHCTRLA_ENABLE) && !channel.enabled )
+  {
+    auto descriptors = (const DmacDescriptor *)(uintptr_t)host_dmac.BASEADDR.reg;
+    channel.desc = descriptors[id];
+    if( !(channel.desc.BTCTRL.reg & DMAC_BTCTRL_VALID) || channel.desc.BTCNT.reg == 0 )
+      fail( "bad descriptor" );
+    channel.enabled = true;
+  }
+  else if( !(value & DMAC_CHCTRLA_ENABLE) && channel.enabled )
+  {
+    channel.enabled = false;
+    write_back( id );
+  }
+}
+
+
+uint32_t read_chctrlb( int )
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  return get_channel().chctrlb;
+}
+
+
+void write_chctrlb( int, uint32_t value )
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  get_channel().chctrlb = value;
+}
+
+
+uint8_t read_chintenset( int )
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  return get_channel().inten;
+}
+
+
+void write_chintenset( int, uint8_t value )
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  get_channel().inten |= value;
+}
+
+
+uint8_t read_chintflag( int )
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  return get_channel().intflag;
+}
+
+
+void write_chintflag( int, uint8_t value )
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  get_channel().intflag &= ~value;
+}
+
+
+uint32_t read_intstatus( int )
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  uint32_t status = 0;
+  for( int id=0; id<DMAC_CH_NUM; id++ )
+    if( channels[id].intflag & channels[id].inten )
+      status |= 1U << id;
+  return status;
+}
+
+
+uint16_t read_intpend( int )
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  for( int id=0; id<DMAC_CH_NUM; id++ )
+    if( channels[id].intflag & channels[id].inten )
+      return id;
+  return 0;
+}
+
+
+template<typename T>
+void write_read_only( int, T )
+{
+  fail( "write to read-only register" );
+}
+
+
+uint8_t read_write_only( int )
+{
+  fail( "read of write-only register" );
+  return 0;
+}
+
+
+void write_intenclr( int, uint8_t value )
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  usart.inten &= ~value;
+}
+
+} // namespace
+
+// The registers
+
+Scb host_scb;
+Pm host_pm;
+Dmac host_dmac;
+Sercom host_sercom0;
+
+
+Dmac::Dmac() :
+  CTRL{ { read_ctrl, write_ctrl, 0 } },
+  BASEADDR{ 0 },
+  WRBADDR{ 0 },
+  CHID{ 0 },
+  CHCTRLA{ { read_chctrla, write_chctrla, 0 } },
+  CHCTRLB{ { read_chctrlb, write_chctrlb, 0 } },
+  CHINTENSET{ { read_chintenset, write_chintenset, 0 } },
+  CHINTFLAG{ { read_chintflag, write_chintflag, 0 } },
+  INTSTATUS{ { read_intstatus, write_read_only<uint32_t>, 0 } },
+  INTPEND{ { read_intpend, write_read_only<uint16_t>, 0 } }
+{
+}
+
+
+Sercom::Sercom() :
+  USART{ { { read_write_only, write_intenclr, 0 } }, { 0 } }
+{
+}
+
+
+void NVIC_EnableIRQ( IRQn_Type irqn )
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  if( irqn >= 0 )
+    nvic_enabled[irqn] = true;
+}
+
+
+void NVIC_DisableIRQ( IRQn_Type irqn )
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  if( irqn >= 0 )
+    nvic_enabled[irqn] = false;
+}
+
+
+void NVIC_SetPendingIRQ( IRQn_Type irqn )
+{
+}
+
+
+void NVIC_ClearPendingIRQ( IRQn_Type irqn )
+{
+}
+
+
+void NVIC_SetPriority( IRQn_Type irqn, uint32_t priority )
+{
+}
+
+
+bool HC::Arm::is_in_interrupt()
+{
+  return in_interrupt;
+}
+
+
+recursive_mutex &HC::Arm::get_primask()
+{
+  static recursive_mutex primask;
+  return primask;
+}
+
+// The Arduino core
+
+SERCOM sercom0( SERCOM0 );
+HostSerial Serial;
+int Uart::irq_handler_calls = 0;
+int Uart::irq_handler_characters = 0;
+
+
+unsigned long millis()
+{
+  return chrono::duration_cast<chrono::milliseconds>( chrono::steady_clock::now() - start_time ).count();
+}
+
+
+unsigned long micros()
+{
+  return chrono::duration_cast<chrono::microseconds>( chrono::steady_clock::now() - start_time ).count();
+}
+
+
+void delay( unsigned long ms )
+{
+  this_thread::sleep_for( chrono::milliseconds( ms ) );
+}
+
+
+extern "C" void yield( void )
+{
+  // As Integration.cpp does, but foreground lets the hardware run
+  if( HC::Coroutine::me() )
+    HC::Coroutine::yield();
+  else
+    this_thread::yield();
+}
+
+
+void HostSerial::println( const char *message )
+{
+  fprintf( stderr, "%s\n", message );
+}
+
+
+SERCOM::SERCOM( Sercom *s ) :
+  sercom( s )
+{
+}
+
+
+void SERCOM::initUART()
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  resetUART();
+  usart.enabled = true;
+  usart.inten = INTFLAG_RXC | INTFLAG_ERROR;
+  usart.intflag = INTFLAG_DRE;
+  NVIC_EnableIRQ( SERCOM0_IRQn );
+}
+
+
+void SERCOM::resetUART()
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  usart = Usart();
+}
+
+
+bool SERCOM::isUARTError()
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  return usart.intflag & INTFLAG_ERROR;
+}
+
+
+void SERCOM::acknowledgeUARTError()
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  usart.intflag &= ~INTFLAG_ERROR;
+}
+
+
+bool SERCOM::isFrameErrorUART()
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  return usart.status & STATUS_FERR;
+}
+
+
+void SERCOM::clearFrameErrorUART()
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  usart.status &= ~STATUS_FERR;
+}
+
+
+bool SERCOM::isBufferOverflowErrorUART()
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  return usart.status & STATUS_BUFOVF;
+}
+
+
+bool SERCOM::isParityErrorUART()
+{
+  return false;
+}
+
+
+void SERCOM::clearStatusUART()
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  usart.status = 0;
+}
+
+
+bool SERCOM::availableDataUART()
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  return usart.intflag & INTFLAG_RXC;
+}
+
+
+bool SERCOM::isDataRegisterEmptyUART()
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  return usart.intflag & INTFLAG_DRE;
+}
+
+
+uint8_t SERCOM::readDataUART()
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  return receive_data();
+}
+
+
+int SERCOM::writeDataUART( uint8_t data )
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  transmit( data );
+  return 1;
+}
+
+
+void SERCOM::enableDataRegisterEmptyInterruptUART()
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  usart.inten |= INTFLAG_DRE;
+}
+
+
+void SERCOM::disableDataRegisterEmptyInterruptUART()
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  usart.inten &= ~INTFLAG_DRE;
+}
+
+
+size_t Print::write( const uint8_t *buffer, size_t size )
+{
+  size_t n = 0;
+  while( size-- && write( *buffer++ ) )
+    n++;
+  return n;
+}
+
+
+size_t Print::write( const char *str )
+{
+  size_t size = 0;
+  while( str[size] )
+    size++;
+  return write( (const uint8_t *)str, size );
+}
+
+
+Uart::Uart( SERCOM *_s, uint8_t _pinRX, uint8_t _pinTX, SercomRXPad _padRX, SercomUartTXPad _padTX ) :
+  sercom( _s )
+{
+}
+
+
+Uart::Uart( SERCOM *_s, uint8_t _pinRX, uint8_t _pinTX, SercomRXPad _padRX, SercomUartTXPad _padTX, uint8_t _pinRTS, uint8_t _pinCTS ) :
+  sercom( _s )
+{
+}
+
+
+void Uart::begin( unsigned long baudRate )
+{
+  sercom->initUART();
+}
+
+
+void Uart::begin( unsigned long baudrate, uint16_t config )
+{
+  sercom->initUART();
+}
+
+
+void Uart::end()
+{
+  sercom->resetUART();
+}
+
+
+void Uart::flush()
+{
+}
+
+
+size_t Uart::write( uint8_t data )
+{
+  while( !sercom->isDataRegisterEmptyUART() )
+  {
+  }
+  sercom->writeDataUART( data );
+  return 1;
+}
+
+
+void Uart::IrqHandler()
+{
+  // As the core's, this takes whatever character is waiting
+  irq_handler_calls++;
+  if( sercom->availableDataUART() )
+  {
+    sercom->readDataUART();
+    irq_handler_characters++;
+  }
+}
+
+// Control from the tests
+
+void Mock::begin( void (**sercom_vector_p_)(), void (**dmac_vector_p_)() )
+{
+  sercom_vector_p = sercom_vector_p_;
+  dmac_vector_p = dmac_vector_p_;
+  running = true;
+  hardware_thread = thread( run );
+}
+
+
+void Mock::end()
+{
+  running = false;
+  hardware_thread.join();
+}
+
+
+void Mock::receive( const string &data, When when )
+{
+  for( char c : data )
+    push( { RxEvent::CHARACTER, (uint8_t)c, when, nullptr } );
+}
+
+
+void Mock::receive_frame_error( uint8_t data, When when )
+{
+  push( { RxEvent::FRAME_ERROR, data, when, nullptr } );
+}
+
+
+void Mock::receive_break( When when )
+{
+  receive_frame_error( 0, when );
+}
+
+
+void Mock::overrun( When when )
+{
+  push( { RxEvent::OVERRUN, 0, when, nullptr } );
+}
+
+
+void Mock::action( function<void()> run )
+{
+  push( { RxEvent::ACTION, 0, WHEN_LISTENING, run } );
+}
+
+
+void Mock::wait_until_idle()
+{
+  while( true )
+  {
+    {
+      lock_guard<recursive_mutex> guard( lock() );
+      if( rx_events.empty() )
+        break;
+    }
+    this_thread::yield();
+  }
+  const unsigned start = steps;
+  while( steps - start < 4 )
+    this_thread::yield();
+}
+
+
+void Mock::dma_bus_error( int beats )
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  beats_to_bus_error = beats;
+}
+
+
+void Mock::force_dre_interrupt()
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  usart.inten |= INTFLAG_DRE;
+}
+
+
+bool Mock::is_dre_interrupt_enabled()
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  return usart.inten & INTFLAG_DRE;
+}
+
+
+string Mock::take_transmitted()
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  string result;
+  result.swap( transmitted );
+  return result;
+}
+
+
+void Mock::reset()
+{
+  lock_guard<recursive_mutex> guard( lock() );
+  rx_events.clear();
+  transmitted.clear();
+  beats_to_bus_error = -1;
+  Uart::irq_handler_calls = 0;
+  Uart::irq_handler_characters = 0;
+}
@@ -0,0 +1,120 @@
+/**
+ * @file MockHardware.h
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ * 
+ * @brief Mock SERCOM and DMAC for the host tests.
+ *
+ * The hardware runs on its own thread. Each step, it moves the next
+ * scripted receive event onto the SERCOM, lets the DMAC take beats, and 
+ * calls the SERCOM and DMAC vectors if their interrupts are pending. It 
+ * holds PRIMASK (see HostArm.h) while it does so, so it doesn't run 
+ * while the code under test has interrupts masked, and the vectors run
+ * as interrupts would.
+ *
+ * Receive events wait until someone is listening, which is when a DMAC
+ * channel is triggered by the SERCOM or the receive interrupt is on,
+ * and until the last character has been taken. A character with a frame 
+ * error is received like any other, with the frame error and error 
+ * interrupt flags set. A break is a frame error on a zero character.
+ *
+ * Memory the DMAC is given must have a 32-bit address, so the tests are
+ * linked without PIE and must use static buffers.
+ */
+#ifndef MockHardware_h
+#define MockHardware_h
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <string>
+
+namespace Mock
+{
+
+/**
+ * When a receive event happens, relative to whoever is listening.
+ */
+enum When
+{
+  WHEN_LISTENING, ///< wait until someone is listening
+  WHEN_NOW, ///< don't wait
+  WHEN_LISTENING_ISR_FIRST ///< as WHEN_LISTENING, but the SERCOM interrupt runs before the DMAC takes it
+};
+
+/**
+ * Start the hardware thread.
+ *
+ * @param sercom_vector_p the SERCOM0 vector, as given to `HC::Uart`.
+ * @param dmac_vector_p the DMAC vector, as given to `HC::DmaController`.
+ */
+void begin( void (**sercom_vector_p)(), void (**dmac_vector_p)() );
+
+/**
+ * Stop the hardware thread.
+ */
+void end();
+
+/**
+ * Receive some characters.
+ */
+void receive( const std::string &data, When when = WHEN_LISTENING );
+
+/**
+ * Receive a character with a frame error.
+ */
+void receive_frame_error( uint8_t data, When when = WHEN_LISTENING );
+
+/**
+ * Receive a break.
+ */
+void receive_break( When when = WHEN_LISTENING );
+
+/**
+ * Lose a character to a buffer overflow.
+ */
+void overrun( When when = WHEN_LISTENING );
+
+/**
+ * Call a function from the hardware thread, with PRIMASK held, once 
+ * everything received before it has been taken.
+ */
+void action( std::function<void()> run );
+
+/**
+ * Wait until all the receive events have happened, and the hardware 
+ * has had a few steps since.
+ */
+void wait_until_idle();
+
+/**
+ * Stop whichever DMAC channel next takes a beat with a bus error, after
+ * this many more beats.
+ */
+void dma_bus_error( int beats );
+
+/**
+ * Turn the SERCOM's data register empty interrupt on behind the back 
+ * of the code under test.
+ */
+void force_dre_interrupt();
+
+/**
+ * Whether the SERCOM's data register empty interrupt is on.
+ */
+bool is_dre_interrupt_enabled();
+
+/**
+ * Get everything transmitted so far, and forget it.
+ */
+std::string take_transmitted();
+
+/**
+ * Clear the characters and counts left by a test.
+ */
+void reset();
+
+} // namespace
+
+#endif
@@ -0,0 +1,128 @@
+/**
+ * @file SwitchBenchmark.cpp
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ *
+ * @brief Compare a `switch_context()` round trip with the same round
+ * trip done with setjmp/longjmp, as Coroutine used to, and time a whole
+ * invoke/yield round trip.
+ *
+ * All of this runs on the host, so it compares the host's context switch
+ * (see HostArm.S) with the host's setjmp/longjmp, in TSC ticks. The
+ * invoke/yield round trip includes the mock PRIMASK, which is a mutex
+ * here. For the Arm numbers, run examples/benchmark on a board.
+ */
+
+// glibc's checked longjmp won't jump to another stack
+#undef _FORTIFY_SOURCE
+
+#include "Coroutine.h"
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <x86intrin.h>
+
+using namespace std;
+using namespace HC;
+using namespace Arm;
+
+#define ITERATIONS 100000
+#define RUNS 20
+
+// The library's default stack is sized for Arm, and x86-64 frames are
+// bigger; the dynamic linker alone needs a few KB the first time a
+// function is called
+static byte switch_stack[16384] __attribute__((aligned(16)));
+static byte setjmp_stack[16384] __attribute__((aligned(16)));
+static byte coroutine_stack[16384] __attribute__((aligned(16)));
+
+static Context parent_context;
+static Context child_context;
+static jmp_buf parent_buf;
+static jmp_buf child_buf;
+
+
+static void switch_child( void * )
+{
+  while(1)
+    switch_context( &child_context, &parent_context );
+}
+
+
+static void setjmp_child( void * )
+{
+  // Started by a switch, then only ever resumed by longjmp
+  if( !_setjmp( child_buf ) )
+    switch_context( &child_context, &parent_context );
+  while(1)
+    if( !_setjmp( child_buf ) )
+      _longjmp( parent_buf, 1 );
+}
+
+
+static void ping_child()
+{
+  while(1)
+    Coroutine::yield();
+}
+
+
+static uint64_t time_switch()
+{
+  const uint64_t t0 = __rdtsc();
+  for( int i=0; i<ITERATIONS; i++ )
+    switch_context( &parent_context, &child_context );
+  return __rdtsc() - t0;
+}
+
+
+static uint64_t time_setjmp()
+{
+  const uint64_t t0 = __rdtsc();
+  for( volatile int i=0; i<ITERATIONS; i++ )
+    if( !_setjmp( parent_buf ) )
+      _longjmp( child_buf, 1 );
+  return __rdtsc() - t0;
+}
+
+
+static uint64_t time_invoke( Coroutine &ping_task )
+{
+  const uint64_t t0 = __rdtsc();
+  for( int i=0; i<ITERATIONS; i++ )
+    ping_task();
+  return __rdtsc() - t0;
+}
+
+
+template<typename F>
+static double best_of_runs( F run )
+{
+  uint64_t best = UINT64_MAX;
+  for( int i=0; i<RUNS; i++ )
+    best = min( best, run() );
+  return (double)best / ITERATIONS;
+}
+
+
+int main()
+{
+  prepare_entry_context( child_context, switch_stack + sizeof(switch_stack), switch_child, nullptr );
+  const double switch_ticks = best_of_runs( time_switch );
+
+  prepare_entry_context( child_context, setjmp_stack + sizeof(setjmp_stack), setjmp_child, nullptr );
+  switch_context( &parent_context, &child_context );
+  const double setjmp_ticks = best_of_runs( time_setjmp );
+
+  // It never completes, so it is never destroyed
+  Coroutine * const ping_task = new Coroutine( ping_child, coroutine_stack, sizeof(coroutine_stack) );
+  const double invoke_ticks = best_of_runs( [=]{ return time_invoke( *ping_task ); } );
+
+  printf( "TSC ticks per round trip, best of %d runs of %d:\n", RUNS, ITERATIONS );
+  printf( "  switch_context():  %.1f\n", switch_ticks );
+  printf( "  setjmp/longjmp:    %.1f\n", setjmp_ticks );
+  printf( "  invoke/yield:      %.1f\n", invoke_ticks );
+  return 0;
+}
@@ -0,0 +1,145 @@
+/**
+ * @file TimerWheelTest.cpp
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ *
+ * @brief Tests for TimerWheel, driven tick by tick with `advance()`.
+ */
+
+#include "TimerWheel.h"
+
+#include <cstdio>
+#include <unistd.h>
+
+using namespace std;
+using namespace HC;
+
+static int failures = 0;
+
+#define CHECK( COND ) do { if( !(COND) ) { fprintf( stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #COND ); failures++; } } while(0)
+
+
+// Advance one tick at a time, checking that each timer fires on its
+// expiry tick and not before
+static void check_fires_on_time( TimerWheel &wheel, TimerWheel::Timer *timers, int num_timers, uint32_t until )
+{
+  int early = 0, late = 0;
+  while( wheel.get_now() != until )
+  {
+    wheel.advance( wheel.get_now() + 1 );
+    for( int i=0; i<num_timers; i++ )
+    {
+      const bool due = (int32_t)(wheel.get_now() - timers[i].expiry) >= 0;
+      if( timers[i].expired.is_set() && !due )
+        early++;
+      if( !timers[i].expired.is_set() && due )
+        late++;
+    }
+  }
+  CHECK( early == 0 );
+  CHECK( late == 0 );
+}
+
+
+static void test_add_not_in_future()
+{
+  TimerWheel wheel;
+  wheel.advance( 10 );
+  TimerWheel::Timer timer;
+  timer.expiry = 10;
+  CHECK( !wheel.add( timer ) );
+  timer.expiry = 9;
+  CHECK( !wheel.add( timer ) );
+  CHECK( wheel.get_ticks_to_next_work( 1000 ) == 1000 );
+}
+
+
+static void test_filing_and_cascading()
+{
+  // One either side of each level boundary, and some in the middle,
+  // starting from a tick that isn't on a boundary of any level
+  const uint32_t start = 0x1237;
+  const uint32_t deltas[] = { 1, 2, 15, 16, 17, 0xFF, 0x100, 0x101, 0x9A5, 0xFFF, 0x1000, 0x1001, 0x8421, 0xFFFF };
+  const int num_timers = sizeof(deltas) / sizeof(deltas[0]);
+  TimerWheel::Timer timers[num_timers];
+
+  TimerWheel wheel;
+  wheel.advance( start );
+  for( int i=0; i<num_timers; i++ )
+  {
+    timers[i].expiry = start + deltas[i];
+    CHECK( wheel.add( timers[i] ) );
+  }
+  CHECK( wheel.get_ticks_to_next_work( 0x10000 ) == 1 );
+  check_fires_on_time( wheel, timers, num_timers, start + 0x10000 );
+}
+
+
+static void test_beyond_wheel()
+{
+  // Further than the whole wheel waits in the top level to be re-filed
+  TimerWheel wheel;
+  wheel.advance( 5 );
+  TimerWheel::Timer timers[2];
+  timers[0].expiry = 5 + 0x10000;
+  timers[1].expiry = 5 + 0x2A5C3;
+  CHECK( wheel.add( timers[0] ) );
+  CHECK( wheel.add( timers[1] ) );
+  check_fires_on_time( wheel, timers, 2, 5 + 0x30000 );
+}
+
+
+static void test_remove()
+{
+  TimerWheel wheel;
+  TimerWheel::Timer timers[4];
+  timers[0].expiry = 3; // level 0
+  timers[1].expiry = 40; // level 1
+  timers[2].expiry = 0x345; // level 2
+  timers[3].expiry = 0x3456; // level 3
+  for( int i=0; i<4; i++ )
+    CHECK( wheel.add( timers[i] ) );
+
+  CHECK( wheel.remove( timers[0] ) );
+  CHECK( wheel.remove( timers[2] ) );
+  CHECK( !wheel.remove( timers[2] ) );
+
+  // Next is re-filing timers[1], when its level 1 slot comes round
+  CHECK( wheel.get_ticks_to_next_work( 1000 ) == 32 );
+
+  // timers[3] has been re-filed lower down by now, and is still found
+  wheel.advance( 0x3000 );
+  CHECK( timers[1].expired.is_set() );
+  CHECK( wheel.remove( timers[3] ) );
+
+  wheel.advance( 0x10000 );
+  CHECK( !timers[0].expired.is_set() );
+  CHECK( !timers[2].expired.is_set() );
+  CHECK( !timers[3].expired.is_set() );
+
+  // Already fired
+  CHECK( !wheel.remove( timers[1] ) );
+}
+
+
+#define RUN( TEST ) do { fprintf( stderr, "%s\n", #TEST ); TEST; } while(0)
+
+int main()
+{
+  // Fail rather than hang
+  alarm( 30 );
+
+  RUN( test_add_not_in_future() );
+  RUN( test_filing_and_cascading() );
+  RUN( test_beyond_wheel() );
+  RUN( test_remove() );
+
+  if( failures )
+  {
+    fprintf( stderr, "%d failed\n", failures );
+    return 1;
+  }
+  fprintf( stderr, "all passed\n" );
+  return 0;
+}
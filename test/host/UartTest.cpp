@@ -0,0 +1,445 @@
+/**
+ * @file UartTest.cpp
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ *
+ * @brief Tests for HC::Uart's receive modes, against the mock SERCOM
+ * and DMAC.
+ */
+
+#include "HC_Uart.h"
+#include "DmaController.h"
+#include "MockHardware.h"
+#include "Hopper.h"
+
+#include <cstdio>
+#include <cstring>
+#include <csignal>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+using namespace HC;
+
+static void (*sercom0_vector)();
+static void (*dmac_vector)();
+static DmaController dma_controller( &dmac_vector );
+static HC::Uart uart( &sercom0, &sercom0_vector, 0, 1, SERCOM_RX_PAD_1, UART_TX_PAD_0 );
+
+// The DMAC needs 32-bit addresses, so no stack buffers
+static uint8_t buffer[64];
+
+// x86-64 frames are bigger than Arm ones; see SwitchBenchmark.cpp
+static byte coroutine_stack[16384] __attribute__((aligned(16)));
+
+static int failures = 0;
+
+#define CHECK( COND ) do { if( !(COND) ) { fprintf( stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #COND ); failures++; } } while(0)
+
+
+static string got( size_t count )
+{
+  return string( (const char *)buffer, count );
+}
+
+
+// Resume a coroutine whenever it's not parked until it completes, and
+// return how many times that took
+static int run_until_complete( Coroutine &coroutine )
+{
+  int resumes = 0;
+  while( !coroutine.is_complete() )
+  {
+    if( coroutine.is_blocked() )
+    {
+      this_thread::yield();
+      continue;
+    }
+    coroutine();
+    resumes++;
+  }
+  return resumes;
+}
+
+
+static void restart( HC::Uart::ReceiveMode mode )
+{
+  uart.end();
+  Mock::wait_until_idle();
+  Mock::reset();
+  uart.set_receive_mode( mode );
+  uart.begin( 115200 );
+}
+
+
+static void test_dmac_already_enabled()
+{
+  // Someone else has the DMAC, so begin() must not reset it. Run in a 
+  // child process, since the assert aborts.
+  DMAC->CTRL.reg = DMAC_CTRL_DMAENABLE;
+  const pid_t pid = fork();
+  if( pid == 0 )
+  {
+    dma_controller.begin();
+    _exit( 0 );
+  }
+  int status = 0;
+  waitpid( pid, &status, 0 );
+  CHECK( WIFSIGNALED( status ) && WTERMSIG( status ) == SIGABRT );
+  CHECK( DMAC->CTRL.reg == DMAC_CTRL_DMAENABLE );
+  DMAC->CTRL.reg = 0;
+}
+
+
+static void test_adaptive_outside_begin_hop()
+{
+  // Adaptive HOPPED_RECEIVE uses the hop slot of the hop that began the
+  // port, so reading from another hop nested inside it must assert. Run
+  // in a child process, since the assert aborts.
+  const pid_t pid = fork();
+  if( pid == 0 )
+  {
+    static Scheduler scheduler;
+    uart.set_receive_mode( HC::Uart::HOPPED_RECEIVE );
+    uart.set_adaptive( &scheduler, SERCOM0_IRQn );
+    Coroutine reader( []
+    {
+      Hopper on_uart( []{ uart.begin( 115200 ); }, []{} );
+      Coroutine::yield();
+      Hopper elsewhere( []{}, []{} );
+      uart.read();
+    }, coroutine_stack, sizeof(coroutine_stack) );
+    reader();
+    reader();
+    _exit( 0 );
+  }
+  int status = 0;
+  waitpid( pid, &status, 0 );
+  CHECK( WIFSIGNALED( status ) && WTERMSIG( status ) == SIGABRT );
+}
+
+
+static void test_dma_block()
+{
+  Mock::receive( "hello" );
+  HC::Uart::Error error;
+  const size_t count = uart.read( buffer, 5, &error );
+  CHECK( count == 5 );
+  CHECK( got( count ) == "hello" );
+  CHECK( error == HC::Uart::NO_ERROR );
+}
+
+
+static void test_dma_parked_read()
+{
+  // In a coroutine, the reader parks until the block is complete or 
+  // there's an error, and is only resumed then
+  size_t count = 0;
+  HC::Uart::Error error;
+  Coroutine reader( [&]{ count = uart.read( buffer, 5, &error ); }, 
+                    coroutine_stack, sizeof(coroutine_stack) );
+  reader();
+  CHECK( reader.is_blocked() && !reader.is_complete() );
+  Mock::receive( "parks" );
+  CHECK( run_until_complete( reader ) == 1 );
+  CHECK( count == 5 );
+  CHECK( got( count ) == "parks" );
+  CHECK( error == HC::Uart::NO_ERROR );
+
+  reader.restart();
+  reader();
+  CHECK( reader.is_blocked() && !reader.is_complete() );
+  Mock::receive( "ab" );
+  Mock::receive_frame_error( 'x' );
+  CHECK( run_until_complete( reader ) == 1 );
+  CHECK( count == 2 );
+  CHECK( got( count ) == "ab" );
+  CHECK( error == HC::Uart::FRAME_ERROR );
+}
+
+
+static void test_dma_frame_error( Mock::When when )
+{
+  // The DMAC may or may not have taken the bad character when the
+  // SERCOM interrupt runs; either way, it's not counted.
+  Mock::receive( "abc" );
+  Mock::receive_frame_error( 'x', when );
+  HC::Uart::Error error;
+  size_t count = uart.read( buffer, 8, &error );
+  CHECK( count == 3 );
+  CHECK( got( count ) == "abc" );
+  CHECK( error == HC::Uart::FRAME_ERROR );
+
+  Mock::receive( "ok" );
+  count = uart.read( buffer, 2, &error );
+  CHECK( count == 2 );
+  CHECK( got( count ) == "ok" );
+  CHECK( error == HC::Uart::NO_ERROR );
+}
+
+
+static void test_dma_break_at_start()
+{
+  Mock::receive_break();
+  HC::Uart::Error error;
+  const size_t count = uart.read( buffer, 4, &error );
+  CHECK( count == 0 );
+  CHECK( error == HC::Uart::FRAME_ERROR );
+}
+
+
+static void test_dma_break_while_not_reading()
+{
+  // Nobody to tell, so it's dropped
+  Mock::receive_break( Mock::WHEN_NOW );
+  Mock::wait_until_idle();
+  Mock::receive( "zz" );
+  HC::Uart::Error error;
+  const size_t count = uart.read( buffer, 2, &error );
+  CHECK( count == 2 );
+  CHECK( got( count ) == "zz" );
+  CHECK( error == HC::Uart::NO_ERROR );
+}
+
+
+static void test_dma_dmx_frames()
+{
+  // DMX512: each frame is a break, then a start code and the slots
+  Mock::receive_break();
+  Mock::receive( string( "\0abc", 4 ) );
+  Mock::receive_break();
+  Mock::receive( string( "\0xyz", 4 ) );
+  HC::Uart::Error error;
+  size_t count = uart.read( buffer, 8, &error );
+  CHECK( count == 0 );
+  CHECK( error == HC::Uart::FRAME_ERROR );
+
+  count = uart.read( buffer, sizeof(buffer), &error );
+  CHECK( count == 4 );
+  CHECK( got( count ) == string( "\0abc", 4 ) );
+  CHECK( error == HC::Uart::FRAME_ERROR );
+
+  count = uart.read( buffer, 4, &error );
+  CHECK( count == 4 );
+  CHECK( got( count ) == string( "\0xyz", 4 ) );
+  CHECK( error == HC::Uart::NO_ERROR );
+}
+
+
+static void test_dma_overrun()
+{
+  Mock::receive( "ab" );
+  Mock::overrun();
+  HC::Uart::Error error;
+  const size_t count = uart.read( buffer, 8, &error );
+  CHECK( count == 2 );
+  CHECK( got( count ) == "ab" );
+  CHECK( error == HC::Uart::OVERRUN_ERROR );
+}
+
+
+static void test_dma_with_dre_interrupt()
+{
+  // The SERCOM interrupt runs all the time, even ahead of the DMAC, 
+  // and must leave the characters to it
+  Mock::force_dre_interrupt();
+  Mock::receive( "0123456789", Mock::WHEN_LISTENING_ISR_FIRST );
+  HC::Uart::Error error;
+  const size_t count = uart.read( buffer, 10, &error );
+  CHECK( count == 10 );
+  CHECK( got( count ) == "0123456789" );
+  CHECK( error == HC::Uart::NO_ERROR );
+  CHECK( ::Uart::irq_handler_calls == 0 );
+  CHECK( ::Uart::irq_handler_characters == 0 );
+}
+
+
+static void test_dma_end_while_reading()
+{
+  // end() wakes the reader with what it's got so far
+  Mock::receive( "abc" );
+  Mock::action( []{ uart.end(); } );
+  HC::Uart::Error error;
+  const size_t count = uart.read( buffer, 8, &error );
+  CHECK( count == 3 );
+  CHECK( got( count ) == "abc" );
+  CHECK( error == HC::Uart::NO_ERROR );
+
+  // Doesn't wait once ended
+  CHECK( uart.read( buffer, 8, &error ) == 0 );
+}
+
+
+static void test_write_polled()
+{
+  CHECK( uart.write( (const uint8_t *)"hi there", 8 ) == 8 );
+  CHECK( uart.write( (uint8_t)'!' ) == 1 );
+  Mock::wait_until_idle();
+  CHECK( Mock::take_transmitted() == "hi there!" );
+}
+
+
+static void test_dma_write_bus_error()
+{
+  // A bus error part way ends the block early, with what got out
+  static const char message[] = "abcdefgh";
+  size_t count = 0;
+  Coroutine writer( [&]{ count = uart.write( (const uint8_t *)message, 8 ); }, 
+                    coroutine_stack, sizeof(coroutine_stack) );
+  Mock::dma_bus_error( 3 );
+  run_until_complete( writer );
+  CHECK( count == 3 );
+  Mock::wait_until_idle();
+  CHECK( Mock::take_transmitted() == "abc" );
+
+  // The next block goes out in full
+  writer.restart();
+  run_until_complete( writer );
+  CHECK( count == 8 );
+  Mock::wait_until_idle();
+  CHECK( Mock::take_transmitted() == "abcdefgh" );
+}
+
+
+static void test_hopped_write( bool nested )
+{
+  // In HOPPED_RECEIVE, DRE may only be turned on by the coroutine that
+  // begin() put on the interrupt, while it's still in that hop. Nested 
+  // in another hop whose detach doesn't end the port, it must poll. The
+  // interrupt is kept off, so that only we resume the coroutine.
+  static const char message[] = "hopped";
+  size_t count = 0;
+  Coroutine writer( [&]
+  {
+    Hopper on_uart( []{ uart.begin( 115200 ); NVIC_DisableIRQ( SERCOM0_IRQn ); }, []{} );
+    Coroutine::yield();
+    if( nested )
+    {
+      Hopper elsewhere( []{}, []{} );
+      count = uart.write( (const uint8_t *)message, 6 );
+    }
+    else
+    {
+      count = uart.write( (const uint8_t *)message, 6 );
+    }
+  }, coroutine_stack, sizeof(coroutine_stack) );
+  
+  uart.end();
+  Mock::wait_until_idle();
+  Mock::reset();
+  uart.set_receive_mode( HC::Uart::HOPPED_RECEIVE );
+  bool dre_seen = false;
+  while( !writer.is_complete() )
+  {
+    writer();
+    dre_seen |= Mock::is_dre_interrupt_enabled();
+  }
+  CHECK( dre_seen == !nested );
+  CHECK( !Mock::is_dre_interrupt_enabled() );
+  CHECK( count == 6 );
+  Mock::wait_until_idle();
+  CHECK( Mock::take_transmitted() == "hopped" );
+  
+  // Before the vector is left pointing at a coroutine that's gone
+  uart.end();
+}
+
+
+static void test_buffered_read_available()
+{
+  // With no idle time, each call returns what the first wakeup brings
+  Mock::receive( "abcde" );
+  string all;
+  while( all.size() < 5 )
+  {
+    HC::Uart::Error error;
+    const size_t count = uart.read_available( buffer, sizeof(buffer), &error );
+    CHECK( count > 0 );
+    CHECK( error == HC::Uart::NO_ERROR );
+    all += got( count );
+  }
+  CHECK( all == "abcde" );
+}
+
+
+static void test_buffered_restart()
+{
+  // Nothing survives end()
+  Mock::receive( "old" );
+  Mock::wait_until_idle();
+  restart( HC::Uart::BUFFERED_RECEIVE );
+  Mock::receive( "new" );
+  HC::Uart::Error error;
+  const size_t count = uart.read( buffer, 3, &error );
+  CHECK( count == 3 );
+  CHECK( got( count ) == "new" );
+  CHECK( error == HC::Uart::NO_ERROR );
+}
+
+
+static void test_buffered_frame_error()
+{
+  Mock::receive( "abc" );
+  Mock::receive_frame_error( 'x' );
+  Mock::receive( "d" );
+  HC::Uart::Error error;
+  size_t count = uart.read( buffer, 8, &error );
+  CHECK( count == 3 );
+  CHECK( got( count ) == "abc" );
+  CHECK( error == HC::Uart::FRAME_ERROR );
+}
+
+
+#define RUN( TEST ) do { fprintf( stderr, "%s\n", #TEST ); TEST; } while(0)
+
+int main()
+{
+  // Fail rather than hang
+  alarm( 30 );
+
+  // Before the mock hardware's thread starts, for fork()
+  RUN( test_dmac_already_enabled() );
+  RUN( test_adaptive_outside_begin_hop() );
+
+  Mock::begin( &sercom0_vector, &dmac_vector );
+  dma_controller.begin();
+  uart.set_dma( &dma_controller, 0, SERCOM0, SERCOM0_DMAC_ID_RX );
+  uart.set_tx_dma( &dma_controller, 1, SERCOM0, SERCOM0_DMAC_ID_TX );
+  uart.set_receive_mode( HC::Uart::DMA_RECEIVE );
+  uart.begin( 115200 );
+
+  RUN( test_dma_block() );
+  RUN( test_dma_parked_read() );
+  RUN( test_dma_frame_error( Mock::WHEN_LISTENING ) );
+  RUN( test_dma_frame_error( Mock::WHEN_LISTENING_ISR_FIRST ) );
+  RUN( test_dma_break_at_start() );
+  RUN( test_dma_break_while_not_reading() );
+  RUN( test_dma_dmx_frames() );
+  RUN( test_dma_overrun() );
+  RUN( test_dma_with_dre_interrupt() );
+  RUN( test_dma_end_while_reading() );
+  restart( HC::Uart::DMA_RECEIVE );
+  RUN( test_write_polled() );
+  RUN( test_dma_write_bus_error() );
+  RUN( test_hopped_write( false ) );
+  RUN( test_hopped_write( true ) );
+
+  restart( HC::Uart::BUFFERED_RECEIVE );
+  RUN( test_buffered_read_available() );
+  RUN( test_buffered_restart() );
+  RUN( test_buffered_frame_error() );
+
+  uart.end();
+  Mock::end();
+
+  if( failures )
+  {
+    fprintf( stderr, "%d failed\n", failures );
+    return 1;
+  }
+  fprintf( stderr, "all passed\n" );
+  return 0;
+}
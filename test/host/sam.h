@@ -0,0 +1,140 @@
+/**
+ * @file sam.h
+ * ### `hopping-coroutines`
+ * _Stacked coroutines for the Arduino environment._\n
+ * @copyright (C) 2020 John Graley; BSD license applies.
+ * 
+ * @brief Host stand-in for the SAMD21 CMSIS header.
+ *
+ * Only the registers and bits the library uses are here, with the 
+ * SAMD21's bit positions. Registers with side effects are `HostReg`s, 
+ * which pass reads and writes on to the mock hardware in 
+ * MockHardware.cpp. There is one SERCOM, `SERCOM0`.
+ */
+#ifndef sam_h
+#define sam_h
+
+#include <cstdint>
+
+// A register whose reads and writes go to the mock hardware
+template<typename T>
+struct HostReg
+{
+  T (*read)( int id );
+  void (*write)( int id, T value );
+  int id;
+
+  operator T() const { return read( id ); }
+  template<typename V>
+  HostReg &operator=( V value ) { write( id, (T)value ); return *this; }
+  template<typename V>
+  HostReg &operator|=( V value ) { write( id, (T)(read( id ) | value) ); return *this; }
+  template<typename V>
+  HostReg &operator&=( V value ) { write( id, (T)(read( id ) & value) ); return *this; }
+};
+
+enum IRQn_Type
+{
+  PendSV_IRQn = -2,
+  SysTick_IRQn = -1,
+  DMAC_IRQn = 6,
+  SERCOM0_IRQn = 9,
+  SERCOM1_IRQn = 10
+};
+
+void NVIC_EnableIRQ( IRQn_Type irqn );
+void NVIC_DisableIRQ( IRQn_Type irqn );
+void NVIC_SetPendingIRQ( IRQn_Type irqn );
+void NVIC_ClearPendingIRQ( IRQn_Type irqn );
+void NVIC_SetPriority( IRQn_Type irqn, uint32_t priority );
+
+struct Scb
+{
+  volatile uint32_t ICSR;
+};
+extern Scb host_scb;
+#define SCB (&host_scb)
+#define SCB_ICSR_PENDSVSET_Msk (1UL << 28)
+#define SCB_ICSR_PENDSVCLR_Msk (1UL << 27)
+
+struct Pm
+{
+  struct { uint32_t reg; } AHBMASK;
+  struct { uint32_t reg; } APBBMASK;
+};
+extern Pm host_pm;
+#define PM (&host_pm)
+#define PM_AHBMASK_DMAC (1UL << 5)
+#define PM_APBBMASK_DMAC (1UL << 4)
+
+#define DMAC_CH_NUM 12
+
+struct DmacDescriptor
+{
+  struct { uint16_t reg; } BTCTRL;
+  struct { uint16_t reg; } BTCNT;
+  struct { uint32_t reg; } SRCADDR;
+  struct { uint32_t reg; } DSTADDR;
+  struct { uint32_t reg; } DESCADDR;
+};
+
+struct Dmac
+{
+  Dmac();
+  struct { HostReg<uint16_t> reg; } CTRL;
+  struct { uint32_t reg; } BASEADDR;
+  struct { uint32_t reg; } WRBADDR;
+  struct { uint8_t reg; } CHID;
+  struct { HostReg<uint8_t> reg; } CHCTRLA;
+  struct { HostReg<uint32_t> reg; } CHCTRLB;
+  struct { HostReg<uint8_t> reg; } CHINTENSET;
+  struct { HostReg<uint8_t> reg; } CHINTFLAG;
+  struct { HostReg<uint32_t> reg; } INTSTATUS;
+  struct { HostReg<uint16_t> reg; } INTPEND;
+};
+extern Dmac host_dmac;
+#define DMAC (&host_dmac)
+
+#define DMAC_CTRL_SWRST (1U << 0)
+#define DMAC_CTRL_DMAENABLE (1U << 1)
+#define DMAC_CTRL_LVLEN(value) ((value) << 8)
+#define DMAC_CHID_ID(value) (value)
+#define DMAC_CHCTRLA_SWRST (1U << 0)
+#define DMAC_CHCTRLA_ENABLE (1U << 1)
+#define DMAC_CHCTRLB_LVL(value) ((value) << 5)
+#define DMAC_CHCTRLB_TRIGSRC(value) ((uint32_t)(value) << 8)
+#define DMAC_CHCTRLB_TRIGSRC_Msk (0x3fU << 8)
+#define DMAC_CHCTRLB_TRIGACT_BEAT (2U << 22)
+#define DMAC_CHINTENSET_TERR (1U << 0)
+#define DMAC_CHINTENSET_TCMPL (1U << 1)
+#define DMAC_CHINTFLAG_TERR (1U << 0)
+#define DMAC_CHINTFLAG_TCMPL (1U << 1)
+#define DMAC_INTPEND_ID_Msk (0xfU)
+#define DMAC_BTCTRL_VALID (1U << 0)
+#define DMAC_BTCTRL_BLOCKACT_INT (1U << 3)
+#define DMAC_BTCTRL_BEATSIZE_BYTE (0U << 8)
+#define DMAC_BTCTRL_SRCINC (1U << 10)
+#define DMAC_BTCTRL_DSTINC (1U << 11)
+
+#define SERCOM0_DMAC_ID_RX 0x01
+#define SERCOM0_DMAC_ID_TX 0x02
+
+struct SercomUsart
+{
+  struct { HostReg<uint8_t> reg; } INTENCLR;
+  struct { volatile uint16_t reg; } DATA;
+};
+
+struct Sercom
+{
+  Sercom();
+  SercomUsart USART;
+};
+extern Sercom host_sercom0;
+#define SERCOM0 (&host_sercom0)
+
+#define SERCOM_USART_INTENCLR_DRE (1U << 0)
+#define SERCOM_USART_INTENCLR_RXC (1U << 2)
+#define SERCOM_USART_INTENCLR_ERROR (1U << 7)
+
+#endif